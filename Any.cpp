@@ -4,13 +4,29 @@
 // Undefine this to prevent tAny from throwing an exception if comparison operators are not defined.
 #define tAnyThrowException
 
+// Define this to add tAny::type() and the type names in the exception messages, it requires RTTI.
+// Without it tAny works with -fno-rtti and values of different types are ordered by the address of their handler.
+// #define tAnyTypeInfo
+
 //********************************************
 // tAny Implementation
+#if defined(tAnyTypeInfo) && !(defined(__cpp_rtti) || defined(__GXX_RTTI) || defined(_CPPRTTI))
+#undef tAnyTypeInfo
+#endif
+
 #include <type_traits>
 #include <typeinfo>
+#include <functional>
+#include <string>
+#include <ostream>
 #include <utility>
 #include <stdexcept>
 #include <memory>
+#include <new>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
 
 // SFINAE helpers
 template<typename T, typename = void>
@@ -29,93 +45,264 @@ struct has_less_operator<T, typename std::enable_if<
     std::is_convertible<decltype(std::declval<T>() < std::declval<T>()), bool>::value
 >::type> : std::true_type {};
 
+template<typename T, typename = void>
+struct has_hash : std::false_type {};
+
+template<typename T>
+struct has_hash<T, typename std::enable_if<
+    std::is_convertible<decltype(std::hash<T>()(std::declval<const T&>())), size_t>::value
+>::type> : std::true_type {};
+
+// Every type converts implicitly to tAny, so an operator<< taking a tAny would satisfy
+// a plain check for any T. The check is done where a deleted operator<< accepts any
+// argument through a user-defined conversion as well: an operator<< reached only
+// through a conversion is then ambiguous, an exact one is still preferred.
+namespace tAnyDetail {
+    struct AnyArgument {
+        template<typename T>
+        AnyArgument(const T&);
+    };
+
+    void operator<<(std::ostream&, AnyArgument) = delete;
+
+    template<typename T, typename = void>
+    struct has_stream_operator : std::false_type {};
+
+    template<typename T>
+    struct has_stream_operator<T, typename std::enable_if<
+        std::is_convertible<decltype(std::declval<std::ostream&>() << std::declval<const T&>()), std::ostream&>::value
+    >::type> : std::true_type {};
+}
+
+using tAnyDetail::has_stream_operator;
+
 class tAny {
 private:
-    struct IBase {
-        virtual ~IBase() {}
-        virtual const std::type_info& type() const = 0;
-        virtual std::unique_ptr<IBase> clone() const = 0;
-        virtual bool equals(const IBase*) const = 0;
-        virtual bool less_than(const IBase*) const = 0;
+    // Values up to 3 pointers, nothrow movable, are stored inline without heap allocation
+    static const size_t InlineSize = 3 * sizeof(void*);
+
+    union Storage {
+        void* heap;
+        typename std::aligned_storage<InlineSize, alignof(void*)>::type buffer;
     };
 
     template<typename T>
-    struct Derived : IBase {
-        T value;
+    struct is_inline : std::integral_constant<bool,
+        sizeof(T) <= InlineSize && alignof(Storage) % alignof(T) == 0 && std::is_nothrow_move_constructible<T>::value> {};
 
-        template<typename U>
-        Derived(U&& v) : value(std::forward<U>(v)) {}
+    // Table of the operations of a type, one static constant table per type shared by 
+    // inline and heap storage. Its address identifies the type, is<T>() is a pointer comparison
+    struct Operations {
+        // Inline and trivially copyable values are copied with the storage and not destroyed
+        bool trivial;
+        void (*copy)(const Storage& from, Storage& to);
+        void (*move)(Storage& from, Storage& to);
+        void (*destroy)(Storage&);
+        bool (*equal)(const Storage&, const Storage&);
+        bool (*less)(const Storage&, const Storage&);
+        size_t (*hash)(const Storage&);
+        bool (*print)(std::ostream&, const Storage&);
+        #ifdef tAnyTypeInfo
+        const std::type_info& (*type)();
+        #endif
+    };
 
-        const std::type_info& type() const override { return typeid(T); }
+    template<typename T>
+    struct Handler {
+        static const Operations* operations() {
+            static const Operations table = {
+                is_inline<T>::value && std::is_trivially_copyable<T>::value,
+                &copy, &move, &destroy, &equal, &less, &hash, &print
+                #ifdef tAnyTypeInfo
+                , &type
+                #endif
+            };
+            return &table;
+        }
 
-        std::unique_ptr<IBase> clone() const override {
-            return std::unique_ptr<IBase>(new Derived<T>(value));
+        template<typename U>
+        static void create(Storage& storage, U&& v) {
+            create(storage, std::forward<U>(v), is_inline<T>());
         }
 
-        bool equals(const IBase* other) const override {
-            if (type() != other->type()) return false;
-            return equal_to(static_cast<const Derived<T>*>(other)->value);
+        static T& get(Storage& storage) { return get(storage, is_inline<T>()); }
+        static const T& get(const Storage& storage) { return get(const_cast<Storage&>(storage), is_inline<T>()); }
+
+        static size_t hash(const T& value) { return hash_value(value); }
+
+    private:
+        static void copy(const Storage& from, Storage& to) { create(to, get(from)); }
+        static void move(Storage& from, Storage& to) { move(from, to, is_inline<T>()); }
+        static void destroy(Storage& storage) { destroy(storage, is_inline<T>()); }
+        static bool equal(const Storage& lhs, const Storage& rhs) { return equal_to(get(lhs), get(rhs)); }
+        static bool less(const Storage& lhs, const Storage& rhs) { return less_than(get(lhs), get(rhs)); }
+        static size_t hash(const Storage& storage) { return hash_value(get(storage)); }
+        static bool print(std::ostream& stream, const Storage& storage) { return print_value(stream, get(storage)); }
+        #ifdef tAnyTypeInfo
+        static const std::type_info& type() { return typeid(T); }
+        #endif
+
+        static std::string type_name() {
+            #ifdef tAnyTypeInfo
+            return "Type '" + std::string(typeid(T).name()) + "'";
+            #else
+            return "Type";
+            #endif
         }
 
-        bool less_than(const IBase* other) const override {
-            if (type() != other->type()) return type().before(other->type());
-            return less(static_cast<const Derived<T>*>(other)->value);
+        template<typename U>
+        static void create(Storage& storage, U&& v, std::true_type) { new (&storage.buffer) T(std::forward<U>(v)); }
+        template<typename U>
+        static void create(Storage& storage, U&& v, std::false_type) { storage.heap = new T(std::forward<U>(v)); }
+
+        static T& get(Storage& storage, std::true_type) { return *reinterpret_cast<T*>(&storage.buffer); }
+        static T& get(Storage& storage, std::false_type) { return *static_cast<T*>(storage.heap); }
+
+        static void move(Storage& from, Storage& to, std::true_type) {
+            new (&to.buffer) T(std::move(get(from)));
+            get(from).~T();
         }
+        static void move(Storage& from, Storage& to, std::false_type) { to.heap = from.heap; }
+
+        static void destroy(Storage& storage, std::true_type) { get(storage).~T(); }
+        static void destroy(Storage& storage, std::false_type) { delete static_cast<T*>(storage.heap); }
 
-    private:
         template<typename U = T>
-        typename std::enable_if<has_equal_operator<U>::value, bool>::type
-        equal_to(const T& other) const {
+        static typename std::enable_if<has_equal_operator<U>::value, bool>::type
+        equal_to(const T& value, const T& other) {
             return value == other;
         }
 
         template<typename U = T>
-        typename std::enable_if<!has_equal_operator<U>::value, bool>::type
-        equal_to(const T&) const {
+        static typename std::enable_if<!has_equal_operator<U>::value, bool>::type
+        equal_to(const T&, const T&) {
             #ifdef tAnyThrowException
-            throw std::runtime_error("Type '" + std::string(typeid(T).name()) + "' does not support equality comparison");
+            throw std::runtime_error(type_name() + " does not support equality comparison");
             #else
             return false;
             #endif
         }
 
         template<typename U = T>
-        typename std::enable_if<has_less_operator<U>::value, bool>::type
-        less(const T& other) const {
+        static typename std::enable_if<has_less_operator<U>::value, bool>::type
+        less_than(const T& value, const T& other) {
             return value < other;
         }
 
         template<typename U = T>
-        typename std::enable_if<!has_less_operator<U>::value, bool>::type
-        less(const T&) const {
+        static typename std::enable_if<!has_less_operator<U>::value, bool>::type
+        less_than(const T&, const T&) {
             #ifdef tAnyThrowException
-            throw std::runtime_error("Type '" + std::string(typeid(T).name()) + "' does not support less than comparison");
+            throw std::runtime_error(type_name() + " does not support less than comparison");
             #else
             return false;
             #endif
         }
+
+        template<typename U = T>
+        static typename std::enable_if<has_hash<U>::value, size_t>::type
+        hash_value(const T& value) {
+            return std::hash<T>()(value);
+        }
+
+        template<typename U = T>
+        static typename std::enable_if<!has_hash<U>::value, size_t>::type
+        hash_value(const T&) {
+            #ifdef tAnyThrowException
+            throw std::runtime_error(type_name() + " does not support hashing");
+            #else
+            return 0;
+            #endif
+        }
+
+        template<typename U = T>
+        static typename std::enable_if<has_stream_operator<U>::value, bool>::type
+        print_value(std::ostream& stream, const T& value) {
+            stream << value;
+            return true;
+        }
+
+        template<typename U = T>
+        static typename std::enable_if<!has_stream_operator<U>::value, bool>::type
+        print_value(std::ostream&, const T&) {
+            return false;
+        }
     };
 
-    std::unique_ptr<IBase> ptr;
+    const Operations* ops;
+    Storage storage;
+
+    static size_t combine(size_t hash, const void* tag) {
+        return hash ^ (std::hash<const void*>()(tag) + 0x9e3779b9 + (hash << 6) + (hash >> 2));
+    }
+
+    void move_from(tAny& other) noexcept {
+        ops = other.ops;
+        if (ops) {
+            if (ops->trivial) {
+                storage = other.storage;
+            } else {
+                ops->move(other.storage, storage);
+            }
+            other.ops = nullptr;
+        }
+    }
+
+    void reset() noexcept {
+        if (ops && !ops->trivial) {
+            ops->destroy(storage);
+        }
+        ops = nullptr;
+    }
 
 public:
-    tAny() : ptr(nullptr) {}
+    tAny() : ops(nullptr) {}
 
     template<typename T, typename = typename std::enable_if<!std::is_same<typename std::decay<T>::type, tAny>::value>::type>
-    tAny(T&& value) : ptr(new Derived<typename std::decay<T>::type>(std::forward<T>(value))) {}
+    tAny(T&& value) : ops(Handler<typename std::decay<T>::type>::operations()) {
+        Handler<typename std::decay<T>::type>::create(storage, std::forward<T>(value));
+    }
 
-    tAny(const tAny& other) : ptr(other.ptr ? other.ptr->clone() : nullptr) {}
-    tAny(tAny&& other) noexcept = default;
+    tAny(const tAny& other) : ops(nullptr) {
+        if (other.ops) {
+            if (other.ops->trivial) {
+                storage = other.storage;
+            } else {
+                other.ops->copy(other.storage, storage);
+            }
+            ops = other.ops;
+        }
+    }
+
+    tAny(tAny&& other) noexcept {
+        move_from(other);
+    }
+
+    ~tAny() {
+        reset();
+    }
 
     tAny& operator=(const tAny& other) {
         tAny(other).swap(*this);
         return *this;
     }
 
-    tAny& operator=(tAny&& other) noexcept = default;
+    tAny& operator=(tAny&& other) noexcept {
+        if (this != &other) {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
 
     void swap(tAny& other) noexcept {
-        ptr.swap(other.ptr);
+        tAny temp(std::move(other));
+        other.move_from(*this);
+        move_from(temp);
+    }
+
+    friend void swap(tAny& lhs, tAny& rhs) noexcept {
+        lhs.swap(rhs);
     }
 
     template<typename T>
@@ -123,7 +310,7 @@ public:
         if (!is<T>()) {
             throw std::bad_cast();
         }
-        return static_cast<Derived<T>*>(ptr.get())->value;
+        return Handler<T>::get(storage);
     }
 
     template<typename T>
@@ -131,26 +318,55 @@ public:
         if (!is<T>()) {
             throw std::bad_cast();
         }
-        return static_cast<const Derived<T>*>(ptr.get())->value;
+        return Handler<T>::get(storage);
     }
 
     template<typename T>
     bool is() const {
-        return ptr && typeid(T) == ptr->type();
+        return ops == Handler<typename std::remove_cv<T>::type>::operations();
     }
 
     bool empty() const {
-        return ptr == nullptr;
+        return ops == nullptr;
     }
 
+    #ifdef tAnyTypeInfo
     const std::type_info& type() const {
-        return ptr ? ptr->type() : typeid(void);
+        return ops ? ops->type() : typeid(void);
+    }
+    #endif
+
+    // Identity of the stored type, nullptr when empty
+    const void* type_tag() const {
+        return ops;
+    }
+
+    template<typename T>
+    static const void* type_tag_of() {
+        return Handler<typename std::remove_cv<T>::type>::operations();
+    }
+
+    // Hash of the value combined with its type, values of different types rarely collide
+    size_t hash() const {
+        return ops ? combine(ops->hash(storage), ops) : 0;
+    }
+
+    // Same result as tAny(value).hash() without constructing a tAny
+    template<typename T>
+    static size_t hash_of(const T& value) {
+        return combine(Handler<typename std::remove_cv<T>::type>::hash(value), type_tag_of<T>());
+    }
+
+    // Write the value if its type has an operator<<, return false otherwise
+    bool print(std::ostream& stream) const {
+        return ops && ops->print(stream, storage);
     }
 
     friend bool operator==(const tAny& lhs, const tAny& rhs) {
         if (lhs.empty() && rhs.empty()) return true;
         if (lhs.empty() || rhs.empty()) return false;
-        return lhs.ptr->equals(rhs.ptr.get());
+        if (lhs.ops != rhs.ops) return false;
+        return lhs.ops->equal(lhs.storage, rhs.storage);
     }
 
     friend bool operator!=(const tAny& lhs, const tAny& rhs) {
@@ -160,7 +376,15 @@ public:
     friend bool operator<(const tAny& lhs, const tAny& rhs) {
         if (lhs.empty()) return !rhs.empty();
         if (rhs.empty()) return false;
-        return lhs.ptr->less_than(rhs.ptr.get());
+        if (lhs.ops != rhs.ops) {
+            // Values of different types are ordered by type, consistently within a run only without tAnyTypeInfo
+            #ifdef tAnyTypeInfo
+            return lhs.type().before(rhs.type());
+            #else
+            return std::less<const Operations*>()(lhs.ops, rhs.ops);
+            #endif
+        }
+        return lhs.ops->less(lhs.storage, rhs.storage);
     }
 
     friend bool operator>(const tAny& lhs, const tAny& rhs) {
@@ -175,10 +399,326 @@ public:
         return !(lhs < rhs);
     }
 };
+
+namespace std {
+    template<>
+    struct hash<tAny> {
+        size_t operator()(const tAny& value) const {
+            return value.hash();
+        }
+    };
+}
+
+// Open addressing hash map keyed by tAny, with linear probing and backward shift deletion.
+// Each slot caches the hash and type tag of its key, so a probe compares them before calling
+// the equality of the type, and find<T>() compares values of type T without any indirect call.
+template<typename tValue>
+class tAnyMap {
+private:
+    struct Slot {
+        size_t hash = 0;
+        const void* tag = nullptr;
+        bool used = false;
+        tAny key;
+        tValue value = tValue();
+    };
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+    size_t mask = 0;
+    unsigned shift = 0;
+
+    size_t ideal(size_t hash) const {
+        // Fibonacci hashing, std::hash of integers is often the identity
+        return (size_t)((hash * (size_t)0x9E3779B97F4A7C15ull) >> shift) & mask;
+    }
+
+    void grow() {
+        std::vector<Slot> previous;
+        previous.swap(slots);
+        size_t capacity = previous.empty() ? 16 : previous.size() * 2;
+        slots.resize(capacity);
+        mask = capacity - 1;
+        unsigned bits = 0;
+        while (((size_t)1 << bits) < capacity) {
+            ++bits;
+        }
+        shift = sizeof(size_t) * 8 - bits;
+        for (auto& slot : previous) {
+            if (slot.used) {
+                size_t i = ideal(slot.hash);
+                while (slots[i].used) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = std::move(slot);
+            }
+        }
+    }
+
+    template<typename tEqual>
+    size_t locate(size_t hash, const void* tag, tEqual equal) const {
+        if (slots.empty()) return npos();
+        for (size_t i = ideal(hash); slots[i].used; i = (i + 1) & mask) {
+            if (slots[i].hash == hash && slots[i].tag == tag && equal(slots[i].key)) {
+                return i;
+            }
+        }
+        return npos();
+    }
+
+    size_t locate(const tAny& key, size_t hash) const {
+        return locate(hash, key.type_tag(), [&key](const tAny& other) { return other == key; });
+    }
+
+    // Store a key known to be absent, hash is key.hash()
+    tValue& add(const tAny& key, size_t hash) {
+        if ((count + 1) * 8 > slots.size() * 7) {
+            grow();
+        }
+        size_t i = ideal(hash);
+        while (slots[i].used) {
+            i = (i + 1) & mask;
+        }
+        Slot& slot = slots[i];
+        slot.key = key;
+        slot.hash = hash;
+        slot.tag = key.type_tag();
+        slot.used = true;
+        ++count;
+        return slot.value;
+    }
+
+    static size_t npos() {
+        return (size_t)-1;
+    }
+
+public:
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    void clear() {
+        slots.clear();
+        count = 0;
+        mask = 0;
+    }
+
+    // Insert or return the value of key. The key is hashed once
+    tValue& operator[](const tAny& key) {
+        size_t hash = key.hash();
+        size_t index = locate(key, hash);
+        return index != npos() ? slots[index].value : add(key, hash);
+    }
+
+    // Return false if the key is already present, its value is unchanged
+    bool insert(const tAny& key, const tValue& value) {
+        size_t hash = key.hash();
+        if (locate(key, hash) != npos()) return false;
+        add(key, hash) = value;
+        return true;
+    }
+
+    tValue* find(const tAny& key) {
+        size_t index = locate(key, key.hash());
+        return index == npos() ? nullptr : &slots[index].value;
+    }
+
+    // Lookup by a value of type T, without constructing a tAny. T is decayed as by
+    // the tAny constructor, find("key") looks for a const char* key
+    template<typename T, typename = typename std::enable_if<!std::is_same<typename std::decay<T>::type, tAny>::value>::type>
+    tValue* find(const T& key) {
+        typedef typename std::decay<const T&>::type tKey;
+        const tKey& decayed = key;
+        size_t index = locate(tAny::hash_of(decayed), tAny::type_tag_of<tKey>(), [&decayed](const tAny& other) { return other.as<tKey>() == decayed; });
+        return index == npos() ? nullptr : &slots[index].value;
+    }
+
+    bool erase(const tAny& key) {
+        size_t i = locate(key, key.hash());
+        if (i == npos()) return false;
+
+        // Move back the following keys of the cluster that are not at their ideal slot
+        for (size_t j = (i + 1) & mask; slots[j].used; j = (j + 1) & mask) {
+            size_t k = ideal(slots[j].hash);
+            if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+                slots[i] = std::move(slots[j]);
+                i = j;
+            }
+        }
+        slots[i] = Slot();
+        --count;
+        return true;
+    }
+
+    template<typename tFunction>
+    void for_each(tFunction function) const {
+        for (const auto& slot : slots) {
+            if (slot.used) function(slot.key, slot.value);
+        }
+    }
+};
+
+// Heterogeneous sequence storing the values of each type contiguously in their own column,
+// plus the column and position of each element in insertion order. Scanning the values of one
+// type is a linear pass over a std::vector<T>, visit() walks all the elements in insertion order.
+class tAnyColumns {
+private:
+    struct ColumnBase {
+        const void* tag;
+        ColumnBase(const void* t) : tag(t) {}
+        virtual ~ColumnBase() {}
+        virtual tAny get(size_t index) const = 0;
+        virtual size_t size() const = 0;
+    };
+
+    template<typename T>
+    struct Column : ColumnBase {
+        std::vector<T> values;
+        Column() : ColumnBase(tAny::type_tag_of<T>()) {}
+        tAny get(size_t index) const override { return tAny(values[index]); }
+        size_t size() const override { return values.size(); }
+    };
+
+    std::vector<std::unique_ptr<ColumnBase>> columns;
+    std::vector<uint16_t> types;// Column of each element
+    std::vector<uint32_t> offsets;// Position of each element in its column
+
+    static size_t npos() {
+        return (size_t)-1;
+    }
+
+    template<typename T>
+    size_t column_index() const {
+        const void* tag = tAny::type_tag_of<T>();
+        for (size_t i = 0; i < columns.size(); ++i) {
+            if (columns[i]->tag == tag) return i;
+        }
+        return npos();
+    }
+
+    template<typename T>
+    std::vector<T>& column_values(size_t index) {
+        return static_cast<Column<T>*>(columns[index].get())->values;
+    }
+
+    template<typename T>
+    const std::vector<T>& column_values(size_t index) const {
+        return static_cast<const Column<T>*>(columns[index].get())->values;
+    }
+
+    template<size_t N, typename tFunction>
+    void dispatch(size_t, size_t, const size_t*, tFunction&) const {}
+
+    template<size_t N, typename T, typename... Ts, typename tFunction>
+    void dispatch(size_t type, size_t offset, const size_t* indexes, tFunction& function) const {
+        if (type == indexes[N]) {
+            function(column_values<T>(type)[offset]);
+            return;
+        }
+        dispatch<N + 1, Ts...>(type, offset, indexes, function);
+    }
+
+public:
+    template<typename T>
+    void push_back(T&& value) {
+        typedef typename std::decay<T>::type tType;
+        size_t index = column_index<tType>();
+        if (index == npos()) {
+            if (columns.size() > 0xffff) throw std::length_error("tAnyColumns: too many types");
+            index = columns.size();
+            columns.emplace_back(new Column<tType>());
+        }
+        std::vector<tType>& values = column_values<tType>(index);
+        if (values.size() > 0xffffffffu) throw std::length_error("tAnyColumns: column too large");
+        // The value is stored first, so an exception leaves no index without its value
+        size_t offset = values.size();
+        values.push_back(std::forward<T>(value));
+        try {
+            types.push_back((uint16_t)index);
+            offsets.push_back((uint32_t)offset);
+        } catch (...) {
+            types.resize(offsets.size());
+            values.pop_back();
+            throw;
+        }
+    }
+
+    size_t size() const {
+        return types.size();
+    }
+
+    bool empty() const {
+        return types.empty();
+    }
+
+    void clear() {
+        columns.clear();
+        types.clear();
+        offsets.clear();
+    }
+
+    // Copy of the element at index in insertion order
+    tAny at(size_t index) const {
+        return columns[types[index]]->get(offsets[index]);
+    }
+
+    template<typename T>
+    bool is(size_t index) const {
+        return columns[types[index]]->tag == tAny::type_tag_of<T>();
+    }
+
+    // Contiguous values of type T, nullptr if there is none
+    template<typename T>
+    const std::vector<T>* column() const {
+        size_t index = column_index<T>();
+        return index == npos() ? nullptr : &column_values<T>(index);
+    }
+
+    template<typename T, typename tFunction>
+    void for_each(tFunction function) {
+        size_t index = column_index<T>();
+        if (index == npos()) return;
+        for (auto& value : column_values<T>(index)) function(value);
+    }
+
+    template<typename T, typename tFunction>
+    void for_each(tFunction function) const {
+        size_t index = column_index<T>();
+        if (index == npos()) return;
+        for (const auto& value : column_values<T>(index)) function(value);
+    }
+
+    // Call function for each element in insertion order. Every stored type must be
+    // listed in T, Ts..., otherwise std::invalid_argument is thrown before any call
+    template<typename T, typename... Ts, typename tFunction>
+    void visit(tFunction function) const {
+        const size_t indexes[] = { column_index<T>(), column_index<Ts>()... };
+        for (size_t i = 0; i < columns.size(); ++i) {
+            if (columns[i]->size() > 0 && std::find(std::begin(indexes), std::end(indexes), i) == std::end(indexes)) {
+                throw std::invalid_argument("tAnyColumns::visit: a stored type is not listed");
+            }
+        }
+        for (size_t i = 0; i < types.size(); ++i) {
+            dispatch<0, T, Ts...>(types[i], offsets[i], indexes, function);
+        }
+    }
+};
 //********************************************
 
 //********************************************
 // Test Code
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#if __cplusplus >= 201703L
+#include <any>
+#endif
 
 struct NoCompare {
     NoCompare(int v = 0) : value(v){}
@@ -203,10 +743,352 @@ std::ostream& operator<<(std::ostream& ostream, const tAny& any)
     {
         ostream << "NoCompare::value:" << any.as<NoCompare>().value;
     }
+    else
+    {
+        any.print(ostream);
+    }
 
     return ostream;
 }
 
+template<typename tAnyType, typename T>
+void benchmarkAny(const char* name, const T& value)
+{
+    // Small vectors reused many times, to measure tAny rather than page faults
+    const size_t count = 1000;
+    const size_t rounds = 1000;
+    std::chrono::steady_clock::duration constructTime(0), copyTime(0), destroyTime(0);
+    for (size_t round = 0; round < rounds; ++round)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<tAnyType>* values = new std::vector<tAnyType>();
+        values->reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            values->emplace_back(value);
+        }
+        constructTime += std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        std::vector<tAnyType>* copies = new std::vector<tAnyType>(*values);
+        copyTime += std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        delete values;
+        delete copies;
+        destroyTime += std::chrono::steady_clock::now() - start;
+    }
+
+    std::cout << name << ": construct " << std::chrono::duration_cast<std::chrono::microseconds>(constructTime).count() / 1000.0
+        << " ms, copy " << std::chrono::duration_cast<std::chrono::microseconds>(copyTime).count() / 1000.0
+        << " ms, destroy " << std::chrono::duration_cast<std::chrono::microseconds>(destroyTime).count() / 1000.0 << " ms" << std::endl;
+}
+
+struct LargeValue {
+    LargeValue(int v = 0) : value(v) {}
+    int value;
+    char padding[60];
+};
+
+#if defined(__cpp_rtti) || defined(__GXX_RTTI) || defined(_CPPRTTI)
+#define tAnyBaselineBenchmark
+#endif
+
+#ifdef tAnyBaselineBenchmark
+// tAny before the inline storage: every value on the heap behind a virtual interface, 
+// types compared with typeid. Kept to measure the gain against the real previous behaviour
+class tAnyBaseline {
+private:
+    struct IBase {
+        virtual ~IBase() {}
+        virtual const std::type_info& type() const = 0;
+        virtual std::unique_ptr<IBase> clone() const = 0;
+        virtual bool equals(const IBase*) const = 0;
+        virtual bool less_than(const IBase*) const = 0;
+    };
+
+    template<typename T>
+    struct Derived : IBase {
+        T value;
+
+        template<typename U>
+        Derived(U&& v) : value(std::forward<U>(v)) {}
+
+        const std::type_info& type() const override { return typeid(T); }
+
+        std::unique_ptr<IBase> clone() const override {
+            return std::unique_ptr<IBase>(new Derived<T>(value));
+        }
+
+        bool equals(const IBase* other) const override {
+            if (type() != other->type()) return false;
+            return equal_to(static_cast<const Derived<T>*>(other)->value);
+        }
+
+        bool less_than(const IBase* other) const override {
+            if (type() != other->type()) return type().before(other->type());
+            return less(static_cast<const Derived<T>*>(other)->value);
+        }
+
+    private:
+        template<typename U = T>
+        typename std::enable_if<has_equal_operator<U>::value, bool>::type
+        equal_to(const T& other) const {
+            return value == other;
+        }
+
+        template<typename U = T>
+        typename std::enable_if<!has_equal_operator<U>::value, bool>::type
+        equal_to(const T&) const {
+            throw std::runtime_error("Type '" + std::string(typeid(T).name()) + "' does not support equality comparison");
+        }
+
+        template<typename U = T>
+        typename std::enable_if<has_less_operator<U>::value, bool>::type
+        less(const T& other) const {
+            return value < other;
+        }
+
+        template<typename U = T>
+        typename std::enable_if<!has_less_operator<U>::value, bool>::type
+        less(const T&) const {
+            throw std::runtime_error("Type '" + std::string(typeid(T).name()) + "' does not support less than comparison");
+        }
+    };
+
+    std::unique_ptr<IBase> ptr;
+
+public:
+    tAnyBaseline() : ptr(nullptr) {}
+
+    template<typename T, typename = typename std::enable_if<!std::is_same<typename std::decay<T>::type, tAnyBaseline>::value>::type>
+    tAnyBaseline(T&& value) : ptr(new Derived<typename std::decay<T>::type>(std::forward<T>(value))) {}
+
+    tAnyBaseline(const tAnyBaseline& other) : ptr(other.ptr ? other.ptr->clone() : nullptr) {}
+    tAnyBaseline(tAnyBaseline&& other) noexcept = default;
+
+    tAnyBaseline& operator=(const tAnyBaseline& other) {
+        tAnyBaseline(other).swap(*this);
+        return *this;
+    }
+
+    tAnyBaseline& operator=(tAnyBaseline&& other) noexcept = default;
+
+    void swap(tAnyBaseline& other) noexcept {
+        ptr.swap(other.ptr);
+    }
+
+    bool empty() const {
+        return ptr == nullptr;
+    }
+
+    friend bool operator<(const tAnyBaseline& lhs, const tAnyBaseline& rhs) {
+        if (lhs.empty()) return !rhs.empty();
+        if (rhs.empty()) return false;
+        return lhs.ptr->less_than(rhs.ptr.get());
+    }
+};
+#endif
+
+void dispatchBenchmark()
+{
+    std::vector<tAny> values;
+    for (int i = 0; i < 1000000; ++i)
+    {
+        if (i % 3 == 0) values.emplace_back(i);
+        else if (i % 3 == 1) values.emplace_back((float)i);
+        else values.emplace_back(std::to_string(i % 100));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    double sum = 0;
+    size_t characters = 0;
+    for (int round = 0; round < 10; ++round)
+    {
+        for (const auto& v : values)
+        {
+            if (v.is<int>()) sum += v.as<int>();
+            else if (v.is<float>()) sum += v.as<float>();
+            else if (v.is<std::string>()) characters += v.as<std::string>().size();
+        }
+    }
+    auto dispatchTime = std::chrono::steady_clock::now() - start;
+    std::cout << "10000000 is<T>/as<T> dispatches in " << std::chrono::duration_cast<std::chrono::microseconds>(dispatchTime).count() / 1000.0
+        << " ms (" << sum << ", " << characters << ")" << std::endl;
+}
+
+template<typename tAnyType>
+void sortBenchmark(const char* name)
+{
+    std::vector<tAnyType> values;
+    unsigned int seed = 12345;
+    for (int i = 0; i < 1000000; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        values.emplace_back((int)(seed >> 8));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::sort(values.begin(), values.end());
+    auto sortTime = std::chrono::steady_clock::now() - start;
+    std::cout << "Sorted 1000000 " << name << " in " << std::chrono::duration_cast<std::chrono::microseconds>(sortTime).count() / 1000.0 
+        << " ms, sorted: " << std::is_sorted(values.begin(), values.end()) << std::endl;
+}
+
+void mapBenchmark()
+{
+    const int count = 200000;
+    std::vector<tAny> keys;
+    for (int i = 0; i < count; ++i)
+    {
+        if (i % 2 == 0) keys.emplace_back(i);
+        else keys.emplace_back("key" + std::to_string(i));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::map<tAny, int> tree;
+    for (int i = 0; i < count; ++i) tree[keys[i]] = i;
+    long long treeSum = 0;
+    for (int round = 0; round < 5; ++round)
+        for (const auto& key : keys) treeSum += tree.find(key)->second;
+    auto treeTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    std::unordered_map<tAny, int> unordered;
+    for (int i = 0; i < count; ++i) unordered[keys[i]] = i;
+    long long unorderedSum = 0;
+    for (int round = 0; round < 5; ++round)
+        for (const auto& key : keys) unorderedSum += unordered.find(key)->second;
+    auto unorderedTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    tAnyMap<int> flat;
+    for (int i = 0; i < count; ++i) flat[keys[i]] = i;
+    long long flatSum = 0;
+    for (int round = 0; round < 5; ++round)
+        for (const auto& key : keys) flatSum += *flat.find(key);
+    auto flatTime = std::chrono::steady_clock::now() - start;
+
+    for (int i = 0; i < count; i += 2) flat.erase(keys[i]);
+    bool valid = flat.size() == (size_t)count / 2 && flat.find(2) == nullptr && *flat.find(std::string("key1")) == 1 && flat.find(2.0f) == nullptr;
+    // An array key is looked up as the pointer stored by tAny
+    static const char name[] = "name";
+    flat[tAny(name)] = -1;
+    valid = valid && flat.find(name) != nullptr && *flat.find(name) == -1 && flat.insert(tAny(name), 0) == false;
+
+    std::cout << count << " keys inserted and found 5 times, std::map " << std::chrono::duration_cast<std::chrono::microseconds>(treeTime).count() / 1000.0
+        << " ms, std::unordered_map " << std::chrono::duration_cast<std::chrono::microseconds>(unorderedTime).count() / 1000.0
+        << " ms, tAnyMap " << std::chrono::duration_cast<std::chrono::microseconds>(flatTime).count() / 1000.0
+        << " ms, same results: " << (treeSum == unorderedSum && treeSum == flatSum && valid) << std::endl;
+}
+
+struct SumVisitor
+{
+    double& sum;
+    size_t& characters;
+
+    void operator()(int value) const { sum += value; }
+    void operator()(float value) const { sum += value; }
+    void operator()(const std::string& value) const { characters += value.size(); }
+};
+
+void columnsBenchmark()
+{
+    std::vector<tAny> values;
+    tAnyColumns columns;
+    for (int i = 0; i < 1000000; ++i)
+    {
+        if (i % 4 == 3)
+        {
+            values.emplace_back(std::to_string(i % 100));
+            columns.push_back(std::to_string(i % 100));
+        }
+        else if (i % 2 == 0)
+        {
+            values.emplace_back(i);
+            columns.push_back(i);
+        }
+        else
+        {
+            values.emplace_back((float)i);
+            columns.push_back((float)i);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    double rowSum = 0;
+    for (int round = 0; round < 10; ++round)
+    {
+        for (const auto& v : values)
+        {
+            if (v.is<int>()) rowSum += v.as<int>();
+            else if (v.is<float>()) rowSum += v.as<float>();
+        }
+    }
+    auto rowTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    double columnSum = 0;
+    for (int round = 0; round < 10; ++round)
+    {
+        long long intSum = 0;
+        double floatSum = 0;
+        columns.for_each<int>([&intSum](int value) { intSum += value; });
+        columns.for_each<float>([&floatSum](float value) { floatSum += value; });
+        columnSum += intSum;
+        columnSum += floatSum;
+    }
+    auto columnTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    double visitSum = 0;
+    size_t characters = 0;
+    columns.visit<int, float, std::string>(SumVisitor{ visitSum, characters });
+    auto visitTime = std::chrono::steady_clock::now() - start;
+
+    std::cout << "Sum of the numbers of 1000000 mixed values x10, std::vector<tAny> " << std::chrono::duration_cast<std::chrono::microseconds>(rowTime).count() / 1000.0
+        << " ms, tAnyColumns::for_each " << std::chrono::duration_cast<std::chrono::microseconds>(columnTime).count() / 1000.0
+        << " ms (" << rowSum << ", " << columnSum << "), one visit in insertion order " << std::chrono::duration_cast<std::chrono::microseconds>(visitTime).count() / 1000.0
+        << " ms (" << visitSum << ", " << characters << " characters), element 3: " << columns.at(3) << std::endl;
+
+    try {
+        columns.visit<int, float>(SumVisitor{ visitSum, characters });
+    } catch (std::invalid_argument& e) {
+        std::cout << e.what() << std::endl;
+    }
+
+    // A failed insertion leaves the container unchanged
+    struct ThrowOnCopy {
+        ThrowOnCopy() {}
+        ThrowOnCopy(const ThrowOnCopy&) { throw std::runtime_error("copy failed"); }
+    };
+    const ThrowOnCopy throwOnCopy = ThrowOnCopy();
+    size_t size = columns.size();
+    try {
+        columns.push_back(throwOnCopy);
+    } catch (std::runtime_error&) {
+    }
+    std::cout << "Size after a failed push_back: " << columns.size() << " (" << size << "), last element: " << columns.at(columns.size() - 1) << std::endl;
+}
+
+void anyBenchmark()
+{
+    std::cout << "1000000 values, sizeof(tAny) " << sizeof(tAny) << std::endl;
+    benchmarkAny<tAny>("tAny int (inline)", 10);
+    benchmarkAny<tAny>("tAny std::vector<int> (inline)", std::vector<int>(4, 1));
+    benchmarkAny<tAny>("tAny LargeValue (heap)", LargeValue(1));
+#ifdef tAnyBaselineBenchmark
+    benchmarkAny<tAnyBaseline>("Baseline tAny int (heap)", 10);
+    benchmarkAny<tAnyBaseline>("Baseline tAny std::vector<int> (heap)", std::vector<int>(4, 1));
+    benchmarkAny<tAnyBaseline>("Baseline tAny LargeValue (heap)", LargeValue(1));
+#endif
+#if __cplusplus >= 201703L
+    benchmarkAny<std::any>("std::any int", 10);
+    benchmarkAny<std::any>("std::any std::vector<int>", std::vector<int>(4, 1));
+    benchmarkAny<std::any>("std::any LargeValue", LargeValue(1));
+#endif
+}
+
 int main()
 {
     std::vector<tAny> values = { 10, std::string("Hello world"), 5.4f, NoCompare(-1)};
@@ -231,6 +1113,13 @@ int main()
         }
     }
 
+    // Types without operator<< are not printed
+    bool printed = tAny(LargeValue(1)).print(std::cout);
+    std::cout << "LargeValue printed: " << printed << std::endl;
+    std::cout << "Double: ";
+    printed = tAny(2.5).print(std::cout);
+    std::cout << ", printed: " << printed << std::endl;
+
     // Use try/catch in case tAnyThrowException is defined
     try
     {        
@@ -248,4 +1137,13 @@ int main()
     {
         std::cout << e.what() <<std::endl;
     }
+
+    anyBenchmark();
+    dispatchBenchmark();
+    sortBenchmark<tAny>("tAny");
+#ifdef tAnyBaselineBenchmark
+    sortBenchmark<tAnyBaseline>("baseline tAny");
+#endif
+    mapBenchmark();
+    columnsBenchmark();
 }
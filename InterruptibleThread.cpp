@@ -7,14 +7,242 @@
 #include <atomic>
 #include <mutex>
 #include <thread>
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <future>
+#include <algorithm>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <iterator>
+#include <limits>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
 
 #include <cassert>
 #define ASSERT(expr, msg) assert(((void)(msg), (expr)))
 
+// Define this to record the timings of every task in tTaskInstrumentation.
+// When it is not defined the instrumentation is not compiled at all.
+//#define tInterruptibleThreadInstrumentation
+
+#if defined(tInterruptibleThreadInstrumentation)
+#include <ctime>
+#include <iomanip>
+
+/// Per task records stored in lock-free per-thread ring buffers. Every thread
+/// writes only its own ring, a sequence number per slot (seqlock) lets the
+/// snapshot skip the slots being overwritten. The rings of the terminated
+/// threads are reused by the new ones, so the memory is bounded by the number
+/// of concurrent threads.
+class tTaskInstrumentation
+{
+public:
+    struct tTaskRecord
+    {
+        uint64_t m_TaskId;
+        uint64_t m_ThreadIndex;
+        int64_t m_QueuedNs;           // Submission time, equal to m_StartNs for the threads
+        int64_t m_StartNs;
+        int64_t m_EndNs;
+        int64_t m_CpuNs;              // CPU time of the thread while running the task
+        uint64_t m_CheckPoints;
+        int64_t m_InterruptLatencyNs; // From Interrupt() to tException, -1 if not interrupted
+    };
+
+    static const size_t RingSize = 1024;
+
+    static int64_t Now() noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static int64_t ThreadCpuTime() noexcept
+    {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+        timespec ts;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        {
+            return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        }
+#endif
+        return 0;
+    }
+
+    static uint64_t NextTaskId() noexcept
+    {
+        static std::atomic<uint64_t> nextId(0);
+        return ++nextId;
+    }
+
+    /// Index of the ring owned by the calling thread
+    static uint64_t ThreadIndex() { return CurrentRing().m_Index; }
+
+    static void Record(tTaskRecord record)
+    {
+        tRing& ring = CurrentRing();
+        record.m_ThreadIndex = ring.m_Index;
+        uint64_t position = ring.m_Head.load(std::memory_order_relaxed);
+        tSlot& slot = ring.m_Slots[position % RingSize];
+
+        const uint64_t* pWords = reinterpret_cast<const uint64_t*>(&record);
+        uint64_t sequence = slot.m_Sequence.load(std::memory_order_relaxed);
+        slot.m_Sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WordCount; i++)
+        {
+            slot.m_Words[i].store(pWords[i], std::memory_order_relaxed);
+        }
+        slot.m_Sequence.store(sequence + 2, std::memory_order_release);
+        ring.m_Head.store(position + 1, std::memory_order_release);
+    }
+
+    /// Copy of the records currently stored in all the rings
+    static std::vector<tTaskRecord> Snapshot()
+    {
+        std::vector<tTaskRecord> records;
+        tRegistry& registry = Registry();
+        std::lock_guard<std::mutex> lock(registry.m_Mutex);
+        for (auto& xRing : registry.m_Rings)
+        {
+            uint64_t head = xRing->m_Head.load(std::memory_order_acquire);
+            uint64_t first = head > RingSize ? head - RingSize : 0;
+            for (uint64_t position = first; position < head; position++)
+            {
+                tSlot& slot = xRing->m_Slots[position % RingSize];
+                tTaskRecord record;
+                uint64_t* pWords = reinterpret_cast<uint64_t*>(&record);
+                uint64_t before = slot.m_Sequence.load(std::memory_order_acquire);
+                for (size_t i = 0; i < WordCount; i++)
+                {
+                    pWords[i] = slot.m_Words[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if ((before & 1) == 0 && before == slot.m_Sequence.load(std::memory_order_relaxed))
+                {
+                    records.push_back(record);
+                }
+            }
+        }
+        std::sort(records.begin(), records.end(), [](const tTaskRecord& a, const tTaskRecord& b) { return a.m_StartNs < b.m_StartNs; });
+        return records;
+    }
+
+    static std::string ToJson(const std::vector<tTaskRecord>& records)
+    {
+        std::ostringstream stream;
+        stream << "[";
+        for (size_t i = 0; i < records.size(); i++)
+        {
+            const tTaskRecord& r = records[i];
+            stream << (i ? "," : "") << "\n  {\"task\":" << r.m_TaskId << ",\"thread\":" << r.m_ThreadIndex
+                   << ",\"queued_ns\":" << r.m_QueuedNs << ",\"start_ns\":" << r.m_StartNs << ",\"end_ns\":" << r.m_EndNs
+                   << ",\"cpu_ns\":" << r.m_CpuNs << ",\"checkpoints\":" << r.m_CheckPoints
+                   << ",\"interrupt_latency_ns\":" << r.m_InterruptLatencyNs << "}";
+        }
+        stream << "\n]\n";
+        return stream.str();
+    }
+
+    /// Chrome trace event format, to be loaded in chrome://tracing or Perfetto
+    static std::string ToChromeTrace(const std::vector<tTaskRecord>& records)
+    {
+        std::ostringstream stream;
+        stream << std::fixed << std::setprecision(3);
+        stream << "{\"traceEvents\":[";
+        for (size_t i = 0; i < records.size(); i++)
+        {
+            const tTaskRecord& r = records[i];
+            stream << (i ? "," : "") << "\n  {\"name\":\"task " << r.m_TaskId << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << r.m_ThreadIndex
+                   << ",\"ts\":" << r.m_StartNs / 1000.0 << ",\"dur\":" << (r.m_EndNs - r.m_StartNs) / 1000.0
+                   << ",\"args\":{\"queue_us\":" << (r.m_StartNs - r.m_QueuedNs) / 1000.0 << ",\"cpu_us\":" << r.m_CpuNs / 1000.0
+                   << ",\"checkpoints\":" << r.m_CheckPoints << ",\"interrupt_latency_us\":"
+                   << (r.m_InterruptLatencyNs < 0 ? -1.0 : r.m_InterruptLatencyNs / 1000.0) << "}}";
+        }
+        stream << "\n]}\n";
+        return stream.str();
+    }
+
+private:
+    static const size_t WordCount = sizeof(tTaskRecord) / sizeof(uint64_t);
+
+    struct tSlot
+    {
+        std::atomic<uint64_t> m_Sequence{ 0 };
+        std::atomic<uint64_t> m_Words[WordCount];
+    };
+
+    struct tRing
+    {
+        explicit tRing(uint64_t index) : m_Index(index), m_Head(0), m_InUse(true) {}
+        uint64_t m_Index;
+        std::atomic<uint64_t> m_Head;
+        bool m_InUse;  // Protected by the registry mutex
+        tSlot m_Slots[RingSize];
+    };
+
+    struct tRegistry
+    {
+        std::mutex m_Mutex;
+        std::vector<std::shared_ptr<tRing>> m_Rings;
+    };
+
+    /// Owned by the thread-local storage, gives the ring back when the thread ends
+    struct tRingLease
+    {
+        tRingLease()
+        {
+            tRegistry& registry = Registry();
+            std::lock_guard<std::mutex> lock(registry.m_Mutex);
+            for (auto& xRing : registry.m_Rings)
+            {
+                if (!xRing->m_InUse)
+                {
+                    xRing->m_InUse = true;
+                    m_xRing = xRing;
+                    return;
+                }
+            }
+            m_xRing = std::make_shared<tRing>(registry.m_Rings.size());
+            registry.m_Rings.push_back(m_xRing);
+        }
+
+        ~tRingLease()
+        {
+            tRegistry& registry = Registry();
+            std::lock_guard<std::mutex> lock(registry.m_Mutex);
+            m_xRing->m_InUse = false;
+        }
+
+        std::shared_ptr<tRing> m_xRing;
+    };
+
+    static tRegistry& Registry()
+    {
+        static tRegistry registry;
+        return registry;
+    }
+
+    static tRing& CurrentRing()
+    {
+        static thread_local tRingLease lease;
+        return *lease.m_xRing;
+    }
+};
+#endif
+
 class tInterruptibleThread
 {
 public:
-    class tInterruptionHandler
+    class tInterruptionHandler : public std::enable_shared_from_this<tInterruptionHandler>
     {
     public:
         class tException : public std::exception
@@ -23,143 +251,2531 @@ public:
             virtual char const* what() const noexcept override { return "Thread interrupted"; }
         };
 
-        tInterruptionHandler() : m_Interrupt(false) {}
+        tInterruptionHandler()
+            : m_Interrupt(false)
+#if defined(tInterruptibleThreadInstrumentation)
+            , m_CheckPoints(0)
+            , m_InterruptNs(0)
+            , m_InterruptLatencyNs(-1)
+#endif
+            , m_DeadlineGeneration(0)
+        {}
+        virtual ~tInterruptionHandler() {}
         virtual void InterruptionCheckPoint()
         {
+#if defined(tInterruptibleThreadInstrumentation)
+            m_CheckPoints.fetch_add(1, std::memory_order_relaxed);
+#endif
+            if (m_Interrupt)
+            {
+                ThrowInterrupted();
+            }
+        }
+        bool Interrupted() { return m_Interrupt; }
+
+        /// Non virtual checkpoint for tight loops: a relaxed load of the flag,
+        /// the throwing path is kept out of line
+        bool InterruptRequested() const noexcept { return m_Interrupt.load(std::memory_order_relaxed); }
+        void FastInterruptionCheckPoint()
+        {
+#if defined(tInterruptibleThreadInstrumentation)
+            m_CheckPoints.fetch_add(1, std::memory_order_relaxed);
+#endif
+            if (InterruptRequested())
+            {
+                ThrowInterrupted();
+            }
+        }
+
+        void Interrupt()
+        {
+#if defined(tInterruptibleThreadInstrumentation)
+            int64_t now = tTaskInstrumentation::Now();
+            int64_t expected = 0;
+            m_InterruptNs.compare_exchange_strong(expected, now);
+#endif
+            if (m_Interrupt.exchange(true))
+            {
+                return;
+            }
+
+            // Wake up the waits in progress, they throw tException as soon as they resume.
+            // The mutex of every wait is taken before the notification, so a waiter cannot
+            // be between the check of the flag and the wait. The entries are pinned, their
+            // waiters do not return before the notification is sent, and m_WaitMutex is not
+            // held while locking the waiter mutexes, the waiters take them in the other order.
+            std::vector<tWaitEntry*> entries;
+            {
+                std::lock_guard<std::mutex> lock(m_WaitMutex);
+                m_WaitCondition.notify_all();
+                for (tWaitEntry* pEntry : m_WaitEntries)
+                {
+                    pEntry->m_Pins++;
+                }
+                entries = m_WaitEntries;
+            }
+            for (tWaitEntry* pEntry : entries)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(*pEntry->m_pMutex);
+                }
+                pEntry->m_pCondition->notify_all();
+            }
+            if (!entries.empty())
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_WaitMutex);
+                    for (tWaitEntry* pEntry : entries)
+                    {
+                        pEntry->m_Pins--;
+                    }
+                }
+                m_UnpinCondition.notify_all();
+            }
+
+            std::vector<tListener> listeners;
+            {
+                std::lock_guard<std::mutex> lock(m_ListenersMutex);
+                listeners.swap(m_Listeners);
+            }
+            for (auto& listener : listeners)
+            {
+                if (auto xOwner = listener.m_xOwner.lock())
+                {
+                    listener.m_Callback();
+                }
+            }
+        }
+
+        /// Register a callback invoked by Interrupt() if the owner is still alive.
+        /// Only a weak reference to the owner is kept, the expired listeners are
+        /// dropped while registering new ones. Returns false without registering
+        /// the callback if the handler has already been interrupted.
+        bool OnInterrupt(const std::weak_ptr<void>& xOwner, std::function<void()> callback)
+        {
+            std::lock_guard<std::mutex> lock(m_ListenersMutex);
             if (m_Interrupt)
             {
-                throw tException();
+                return false;
+            }
+            if (m_Listeners.size() == m_Listeners.capacity())
+            {
+                m_Listeners.erase(std::remove_if(m_Listeners.begin(), m_Listeners.end(),
+                                                 [](const tListener& listener) { return listener.m_xOwner.expired(); }),
+                                  m_Listeners.end());
+            }
+            m_Listeners.push_back(tListener{ xOwner, std::move(callback) });
+            return true;
+        }
+
+        /// The child is interrupted together with this handler. Only weak references
+        /// are kept, so the children can be released before the parent.
+        void AddChild(const std::shared_ptr<tInterruptionHandler>& xChild)
+        {
+            // The child is kept alive by the listener owner while the callback runs
+            tInterruptionHandler* pChild = xChild.get();
+            if (!OnInterrupt(xChild, [pChild]() { pChild->Interrupt(); }))
+            {
+                // The parent was interrupted before the child was attached
+                xChild->Interrupt();
+            }
+        }
+
+        std::shared_ptr<tInterruptionHandler> CreateChild()
+        {
+            auto xChild = std::make_shared<tInterruptionHandler>();
+            AddChild(xChild);
+            return xChild;
+        }
+
+        /// Interrupt the handler when the deadline expires, the deadlines of all
+        /// the handlers are served by the single tDeadlineTimer thread.
+        /// The handler must be owned by a std::shared_ptr.
+        void SetDeadline(std::chrono::steady_clock::time_point deadline)
+        {
+            uint64_t generation = ++m_DeadlineGeneration;
+            std::weak_ptr<tInterruptionHandler> xWeakThis(shared_from_this());
+            tDeadlineTimer::Instance().Schedule(deadline, [xWeakThis, generation]()
+            {
+                auto xThis = xWeakThis.lock();
+                if (xThis && xThis->m_DeadlineGeneration == generation)
+                {
+                    xThis->Interrupt();
+                }
+            });
+        }
+
+        template <typename Rep, typename Period>
+        void SetTimeout(const std::chrono::duration<Rep, Period>& t)
+        {
+            SetDeadline(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(t));
+        }
+
+        void ClearDeadline() { ++m_DeadlineGeneration; }
+
+        /// Interruptible std::this_thread::sleep_for
+        template <typename Rep, typename Period>
+        void SleepFor(const std::chrono::duration<Rep, Period>& t)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_WaitMutex);
+                m_WaitCondition.wait_for(lock, t, [&] { return (bool)m_Interrupt; });
+            }
+            InterruptionCheckPoint();
+        }
+
+        /// Interruptible condition.wait(lock, pred), lock must be owned by the caller.
+        /// Several threads can wait on the same handler at the same time. Interrupt()
+        /// locks the mutex of the waits in progress, so it must not be called while
+        /// holding it.
+        template <typename Predicate>
+        void Wait(std::condition_variable& condition, std::unique_lock<std::mutex>& lock, Predicate pred)
+        {
+            {
+                tWaitRegistration registration(*this, condition, lock);
+                condition.wait(lock, [&] { return m_Interrupt || pred(); });
+            }
+            InterruptionCheckPoint();
+        }
+
+        /// Interruptible condition.wait_for(lock, t, pred), returns the value of pred
+        template <typename Rep, typename Period, typename Predicate>
+        bool WaitFor(std::condition_variable& condition, std::unique_lock<std::mutex>& lock,
+                     const std::chrono::duration<Rep, Period>& t, Predicate pred)
+        {
+            bool result = false;
+            {
+                tWaitRegistration registration(*this, condition, lock);
+                condition.wait_for(lock, t, [&] { return m_Interrupt || (result = pred()); });
+            }
+            InterruptionCheckPoint();
+            return result;
+        }
+
+        /// Interruptible future.wait(). A std::future cannot notify its completion, a
+        /// watcher thread blocks on a copy of the future and signals a condition that
+        /// is waited like the other conditions.
+        template <typename T>
+        void Wait(const std::shared_future<T>& future) { WaitFuture(future); }
+
+        /// A std::future cannot be waited by the watcher while the caller owns it, it
+        /// is converted to the returned std::shared_future holding the result
+        template <typename T>
+        std::shared_future<T> Wait(std::future<T>&& future)
+        {
+            std::shared_future<T> shared = future.share();
+            WaitFuture(shared);
+            return shared;
+        }
+
+    protected:
+        static const size_t CacheLineSize = 64;
+
+        // The flag read by the checkpoints gets its own cache line: the alignment keeps
+        // it away from the shared_ptr control block allocated by std::make_shared just
+        // before the handler, the padding away from the members that follow
+        alignas(CacheLineSize) std::atomic_bool m_Interrupt;
+        char m_Padding[CacheLineSize - sizeof(std::atomic_bool)];
+
+    private:
+#if defined(tInterruptibleThreadInstrumentation)
+    public:
+        uint64_t CheckPoints() const noexcept { return m_CheckPoints.load(std::memory_order_relaxed); }
+
+        /// Time from Interrupt() to the first tException, -1 if not thrown yet
+        int64_t InterruptLatencyNs() const noexcept { return m_InterruptLatencyNs.load(std::memory_order_relaxed); }
+
+    private:
+        [[noreturn]] void ThrowInterrupted()
+        {
+            int64_t expected = -1;
+            m_InterruptLatencyNs.compare_exchange_strong(expected, tTaskInstrumentation::Now() - m_InterruptNs.load());
+            throw tException();
+        }
+
+        std::atomic<uint64_t> m_CheckPoints;
+        std::atomic<int64_t> m_InterruptNs;
+        std::atomic<int64_t> m_InterruptLatencyNs;
+#else
+        [[noreturn]] static void ThrowInterrupted() { throw tException(); }
+#endif
+
+        /// Condition of a wait in progress and the mutex protecting its predicate
+        struct tWaitEntry
+        {
+            std::mutex* m_pMutex;
+            std::condition_variable* m_pCondition;
+            uint32_t m_Pins;    // Notifications of Interrupt() in progress, under m_WaitMutex
+        };
+
+        /// Adds the condition to the ones notified by Interrupt() for the duration
+        /// of a wait. m_WaitMutex is taken while holding the waiter lock, Interrupt()
+        /// never holds m_WaitMutex while locking a waiter mutex.
+        class tWaitRegistration
+        {
+        public:
+            tWaitRegistration(tInterruptionHandler& handler, std::condition_variable& condition, std::unique_lock<std::mutex>& lock)
+                : m_Handler(handler)
+                , m_Lock(lock)
+            {
+                m_Entry.m_pMutex = lock.mutex();
+                m_Entry.m_pCondition = &condition;
+                m_Entry.m_Pins = 0;
+                std::lock_guard<std::mutex> guard(m_Handler.m_WaitMutex);
+                m_Handler.m_WaitEntries.push_back(&m_Entry);
+            }
+
+            ~tWaitRegistration()
+            {
+                std::unique_lock<std::mutex> guard(m_Handler.m_WaitMutex);
+                bool pinned = m_Entry.m_Pins != 0;
+                if (pinned)
+                {
+                    // Interrupt() is waiting for the waiter mutex to notify this entry
+                    m_Lock.unlock();
+                    m_Handler.m_UnpinCondition.wait(guard, [&] { return m_Entry.m_Pins == 0; });
+                }
+                std::vector<tWaitEntry*>& entries = m_Handler.m_WaitEntries;
+                entries.erase(std::find(entries.begin(), entries.end(), &m_Entry));
+                guard.unlock();
+                if (pinned)
+                {
+                    m_Lock.lock();
+                }
+            }
+
+        private:
+            tInterruptionHandler& m_Handler;
+            std::unique_lock<std::mutex>& m_Lock;
+            tWaitEntry m_Entry;
+        };
+
+        /// Set by the watcher thread of WaitFuture() when the future is ready
+        struct tFutureSignal
+        {
+            tFutureSignal() : m_Ready(false) {}
+
+            std::mutex m_Mutex;
+            std::condition_variable m_Condition;
+            bool m_Ready;
+        };
+
+        template <typename T>
+        void WaitFuture(const std::shared_future<T>& future)
+        {
+            std::future_status status = future.wait_for(std::chrono::seconds(0));
+            if (status == std::future_status::deferred)
+            {
+                // The deferred function runs in this thread
+                future.wait();
+            }
+            if (status != std::future_status::timeout)
+            {
+                InterruptionCheckPoint();
+                return;
+            }
+
+            // The watcher owns a copy of the future and of the signal, it can outlive
+            // an interrupted wait
+            auto xSignal = std::make_shared<tFutureSignal>();
+            std::thread([xSignal, future]()
+            {
+                future.wait();
+                {
+                    std::lock_guard<std::mutex> lock(xSignal->m_Mutex);
+                    xSignal->m_Ready = true;
+                }
+                xSignal->m_Condition.notify_all();
+            }).detach();
+
+            std::unique_lock<std::mutex> lock(xSignal->m_Mutex);
+            Wait(xSignal->m_Condition, lock, [&] { return xSignal->m_Ready; });
+        }
+
+        std::mutex m_WaitMutex;
+        std::condition_variable m_WaitCondition;  // Wakes up SleepFor()
+        std::condition_variable m_UnpinCondition;
+        std::vector<tWaitEntry*> m_WaitEntries;   // One entry per wait in progress
+        struct tListener
+        {
+            std::weak_ptr<void> m_xOwner;
+            std::function<void()> m_Callback;
+        };
+
+        std::mutex m_ListenersMutex;
+        std::vector<tListener> m_Listeners;
+        std::atomic<uint64_t> m_DeadlineGeneration;
+    };
+    typedef std::shared_ptr<tInterruptionHandler> tInterruptionHandlerPtr;
+
+    /// Checkpoint to be called with the counter of a tight loop, the flag is actually
+    /// checked when the low bits of the counter are zero, once every period iterations
+    /// (rounded up to a power of two). The loop counter is already in a register, so
+    /// the other iterations pay a test and a branch, with no state to update.
+    class tAmortizedCheckPoint
+    {
+    public:
+        tAmortizedCheckPoint(const tInterruptionHandlerPtr& xInterrupHandler, uint64_t period = 1024)
+            : m_pHandler(xInterrupHandler.get())
+            , m_Mask(RoundUp(period) - 1)
+        {}
+
+        void operator()(uint64_t iteration) const
+        {
+            if ((iteration & m_Mask) == 0)
+            {
+                m_pHandler->FastInterruptionCheckPoint();
+            }
+        }
+
+    private:
+        static uint64_t RoundUp(uint64_t period)
+        {
+            uint64_t size = 1;
+            while (size < period)
+            {
+                size <<= 1;
+            }
+            return size;
+        }
+
+        tInterruptionHandler* m_pHandler;
+        const uint64_t m_Mask;
+    };
+
+    /// Single thread running the callbacks scheduled at a given time point.
+    /// The callbacks are executed by the timer thread, so they must be short.
+    class tDeadlineTimer
+    {
+    public:
+        static tDeadlineTimer& Instance()
+        {
+            static tDeadlineTimer timer;
+            return timer;
+        }
+
+        void Schedule(std::chrono::steady_clock::time_point when, std::function<void()> callback)
+        {
+            bool first = false;
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Queue.push_back(tEntry{ when, std::move(callback) });
+                std::push_heap(m_Queue.begin(), m_Queue.end());
+                first = (m_Queue.front().m_When == when);
+            }
+            // The timer thread has to be woken up only if the earliest deadline changed
+            if (first)
+            {
+                m_Condition.notify_one();
+            }
+        }
+
+    private:
+        struct tEntry
+        {
+            std::chrono::steady_clock::time_point m_When;
+            std::function<void()> m_Callback;
+
+            // std::push_heap builds a max heap, the earliest deadline has to be on top
+            bool operator<(const tEntry& other) const { return m_When > other.m_When; }
+        };
+
+        tDeadlineTimer() : m_Stop(false), m_Thread(&tDeadlineTimer::Run, this) {}
+
+        ~tDeadlineTimer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Stop = true;
+            }
+            m_Condition.notify_one();
+            m_Thread.join();
+        }
+
+        void Run()
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            while (!m_Stop)
+            {
+                if (m_Queue.empty())
+                {
+                    m_Condition.wait(lock);
+                    continue;
+                }
+
+                auto when = m_Queue.front().m_When;
+                if (std::chrono::steady_clock::now() < when)
+                {
+                    m_Condition.wait_until(lock, when);
+                    continue;
+                }
+
+                std::pop_heap(m_Queue.begin(), m_Queue.end());
+                std::function<void()> callback = std::move(m_Queue.back().m_Callback);
+                m_Queue.pop_back();
+
+                lock.unlock();
+                callback();
+                lock.lock();
+            }
+        }
+
+        std::vector<tEntry> m_Queue;
+        std::condition_variable m_Condition;
+        std::mutex m_Mutex;
+        bool m_Stop;
+        std::thread m_Thread;
+    };
+
+    /// Completion flag set once by the task. The waiters block on the atomic word
+    /// (std::atomic::wait when available), the mutex is used only by the timed
+    /// waits and by the WhenAny() waiters, and is touched by Set() only if one of
+    /// them is registered.
+    class tCompletionEvent
+    {
+    public:
+        /// Owned by a single call waiting for the first of several events
+        class tAnyWaiter
+        {
+        public:
+            tAnyWaiter() : m_Signaled(false) {}
+
+            void Signal()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_Mutex);
+                    m_Signaled = true;
+                }
+                m_Condition.notify_all();
+            }
+
+            void Wait()
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_Condition.wait(lock, [&] { return m_Signaled; });
+            }
+
+        private:
+            std::mutex m_Mutex;
+            std::condition_variable m_Condition;
+            bool m_Signaled;
+        };
+
+        tCompletionEvent() : m_State(0), m_Waiters(0) {}
+
+        tCompletionEvent(const tCompletionEvent&) = delete;
+        tCompletionEvent& operator=(const tCompletionEvent&) = delete;
+
+        bool IsSet() const noexcept { return m_State.load(std::memory_order_acquire) != 0; }
+
+        void Set()
+        {
+            m_State.store(1);
+#if defined(__cpp_lib_atomic_wait)
+            m_State.notify_all();
+#endif
+            if (m_Waiters.load() != 0)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_Mutex);
+                    for (tAnyWaiter* pWaiter : m_AnyWaiters)
+                    {
+                        pWaiter->Signal();
+                    }
+                }
+                m_Condition.notify_all();
+            }
+        }
+
+        void Wait()
+        {
+#if defined(__cpp_lib_atomic_wait)
+            while (m_State.load(std::memory_order_acquire) == 0)
+            {
+                m_State.wait(0, std::memory_order_acquire);
+            }
+#else
+            WaitUntil(std::chrono::steady_clock::time_point::max());
+#endif
+        }
+
+        template <typename Rep, typename Period>
+        bool WaitFor(const std::chrono::duration<Rep, Period>& t)
+        {
+            return WaitUntil(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(t));
+        }
+
+        bool WaitUntil(std::chrono::steady_clock::time_point deadline)
+        {
+            if (IsSet())
+            {
+                return true;
+            }
+
+            // The waiter is registered before checking the state, so Set() either
+            // sees it or the check below sees the state already set
+            m_Waiters++;
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                if (deadline == std::chrono::steady_clock::time_point::max())
+                {
+                    m_Condition.wait(lock, [&] { return IsSet(); });
+                }
+                else
+                {
+                    m_Condition.wait_until(lock, deadline, [&] { return IsSet(); });
+                }
+            }
+            m_Waiters--;
+            return IsSet();
+        }
+
+        /// Register a waiter signaled by Set(), returns false without registering
+        /// it if the event is already set
+        bool AddAnyWaiter(tAnyWaiter* pWaiter)
+        {
+            // Registered as in WaitUntil(), before checking the state
+            m_Waiters++;
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            if (IsSet())
+            {
+                m_Waiters--;
+                return false;
+            }
+            m_AnyWaiters.push_back(pWaiter);
+            return true;
+        }
+
+        /// Once removed the waiter is not referenced by Set() anymore
+        void RemoveAnyWaiter(tAnyWaiter* pWaiter)
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_AnyWaiters.erase(std::find(m_AnyWaiters.begin(), m_AnyWaiters.end(), pWaiter));
+            m_Waiters--;
+        }
+
+    private:
+        std::atomic<uint32_t> m_State;
+        std::atomic<uint32_t> m_Waiters;
+        std::condition_variable m_Condition;
+        std::mutex m_Mutex;
+        std::vector<tAnyWaiter*> m_AnyWaiters;  // Protected by m_Mutex
+    };
+
+    using Id = std::thread::id;
+
+    using NativeHandleType = std::thread::native_handle_type;
+
+    /// Placement of the thread, applied by the thread itself before running the task.
+    /// The options are best effort: the ones not supported by the platform, or not
+    /// allowed to the process (e.g. real time policies), are ignored.
+    struct tThreadOptions
+    {
+        tThreadOptions() : m_NumaNode(-1), m_SchedPolicy(-1), m_Priority(0) {}
+
+        std::vector<int> m_Cpus;  // CPUs the thread can run on, empty to keep the inherited affinity
+        int m_NumaNode;           // Preferred node for the memory allocated by the thread, -1 to keep the default
+        int m_SchedPolicy;        // SCHED_OTHER, SCHED_FIFO, SCHED_RR..., -1 to keep the inherited one
+        int m_Priority;           // sched_param::sched_priority used with m_SchedPolicy
+        std::string m_Name;       // Name shown by top/perf, truncated to 15 characters on Linux
+    };
+
+
+    tInterruptibleThread() noexcept = default;
+
+    /// Waits for the task, interrupting it first only if SetInterruptOnDestruction(true)
+    /// was called. Joining is the default because the existing callers destroy the
+    /// thread to wait for the result of the task, an interruption would silently drop it.
+    ~tInterruptibleThread()
+    {
+        if (m_xThread && m_xThread->joinable())
+        {
+            if (m_InterruptOnDestruction)
+            {
+                Interrupt();
+            }
+            JoinImp();
+        }
+    }
+
+    template <typename Callable, typename... Args>
+    tInterruptibleThread(bool detached, Callable&& f, tInterruptionHandlerPtr xInterrupHandler, Args&&... args)
+        : tInterruptibleThread(tThreadOptions(), detached, std::forward<Callable>(f), xInterrupHandler, std::forward<Args>(args)...)
+    {}
+
+    template <typename Callable, typename... Args>
+    tInterruptibleThread(const tThreadOptions& options, bool detached, Callable&& f, tInterruptionHandlerPtr xInterrupHandler, Args&&... args)
+        : m_Interruptionhandler(xInterrupHandler)
+        , m_xState(std::make_shared<tState>())
+    {
+        // The state is shared with the task, so the task never touches
+        // the tInterruptibleThread instance, that could be already destroyed
+        std::shared_ptr<tState> xState = m_xState;
+        auto task = [xState, options](typename std::decay<Callable>::type&& f,
+                                      tInterruptionHandlerPtr xInterrupHandler,
+                                      typename std::decay<Args>::type&&... args)
+        {
+            ApplyToCurrentThread(options);
+#if defined(tInterruptibleThreadInstrumentation)
+            tTaskProbe probe(xInterrupHandler, xState->m_CreatedNs);
+#endif
+            try
+            {
+                std::bind(f, std::forward<tInterruptionHandlerPtr>(xInterrupHandler), args...)();
+            }
+            catch (...)
+            {
+                xState->m_ExceptionPtr = std::current_exception();
+            }
+#if defined(tInterruptibleThreadInstrumentation)
+            probe.Record();
+#endif
+            xState->m_Completion.Set();
+        };
+
+        m_xThread = std::unique_ptr<std::thread>(new std::thread(
+              task,
+              std::forward<Callable>(f),
+              xInterrupHandler,
+              std::forward<Args>(args)...));
+
+        if(!m_xThread)
+        {
+            throw std::runtime_error("Cannot create the tread");
+        }
+        
+        if (detached)
+        {
+            m_xThread->detach();
+        }
+    }
+
+    bool Joinable() const noexcept { return m_xThread && m_xThread->joinable(); }
+
+    /// When enabled the destructor interrupts the task before waiting for its
+    /// completion, so it does not block on a task that never ends by itself.
+    /// By default it only waits, see the destructor
+    void SetInterruptOnDestruction(bool interrupt) noexcept { m_InterruptOnDestruction = interrupt; }
+
+    /// True when the task has completed, Join() does not block anymore
+    bool Finished() const noexcept { return m_xState && m_xState->m_Completion.IsSet(); }
+
+    void Join()
+    {
+        JoinImp();
+        RethrowException();
+    }
+
+    /// Join only if the task has already completed
+    bool TryJoin()
+    {
+        if (!Finished())
+        {
+            return false;
+        }
+        Join();
+        return true;
+    }
+
+    template <typename Rep, typename Period>
+    bool JoinFor(const std::chrono::duration<Rep, Period>& t)
+    {
+        if (m_xState && !m_xState->m_Completion.WaitFor(t))
+        {
+            return false;
+        }
+        Join();
+        return true;
+    }
+
+    /// Wait for the completion of all the threads, the exceptions are rethrown by Join()
+    static void WhenAll(const std::vector<tInterruptibleThread*>& threads)
+    {
+        for (tInterruptibleThread* pThread : threads)
+        {
+            if (pThread->m_xState)
+            {
+                pThread->m_xState->m_Completion.Wait();
+            }
+        }
+    }
+
+    /// Wait for the completion of any of the threads and return its index.
+    /// The default constructed threads never complete, at least one thread must run a task
+    static size_t WhenAny(const std::vector<tInterruptibleThread*>& threads)
+    {
+        if (std::none_of(threads.begin(), threads.end(), [](const tInterruptibleThread* pThread) { return (bool)pThread->m_xState; }))
+        {
+            throw std::invalid_argument("WhenAny requires at least one thread running a task");
+        }
+
+        // The waiter is registered only on the events of these threads, so the
+        // completions of the other threads in the process do not wake it up
+        tCompletionEvent::tAnyWaiter waiter;
+        size_t registered = 0;
+        size_t index = threads.size();
+        for (; registered < threads.size(); registered++)
+        {
+            const std::shared_ptr<tState>& xState = threads[registered]->m_xState;
+            if (xState && !xState->m_Completion.AddAnyWaiter(&waiter))
+            {
+                index = registered;
+                break;
+            }
+        }
+        if (index == threads.size())
+        {
+            waiter.Wait();
+        }
+        for (size_t i = 0; i < registered; i++)
+        {
+            if (threads[i]->m_xState)
+            {
+                threads[i]->m_xState->m_Completion.RemoveAnyWaiter(&waiter);
+            }
+        }
+        if (index == threads.size())
+        {
+            index = 0;
+            while (!threads[index]->Finished())
+            {
+                index++;
+            }
+        }
+        return index;
+    }
+
+    tInterruptionHandlerPtr InterruptionHandler() { return m_Interruptionhandler; }
+
+    void Interrupt()
+    {
+        if (m_Interruptionhandler)
+        {
+            m_Interruptionhandler->Interrupt();
+        }
+    }
+
+    Id GetId() const noexcept { return m_xThread->get_id(); }
+
+    NativeHandleType NativeHandle() { return m_xThread->native_handle(); }
+
+    static uint32_t HardwareConcurrency() noexcept { return std::thread::hardware_concurrency(); }
+
+    bool SetAffinity(const std::vector<int>& cpus) { return SetAffinity(NativeHandle(), cpus); }
+
+    bool SetScheduling(int policy, int priority) { return SetScheduling(NativeHandle(), policy, priority); }
+
+    bool SetName(const std::string& name) { return SetName(NativeHandle(), name); }
+
+    /// Apply the options to the calling thread, returns false if any of them failed
+    static bool ApplyToCurrentThread(const tThreadOptions& options)
+    {
+#if defined(__linux__)
+        bool result = true;
+        std::vector<int> cpus = options.m_Cpus;
+        if (options.m_NumaNode >= 0)
+        {
+            // The pages touched from now on, including the rest of the stack,
+            // are preferably allocated on the node
+            unsigned long nodeMask[16] = {};
+            const size_t bits = sizeof(unsigned long) * 8;
+            if ((size_t)options.m_NumaNode < sizeof(nodeMask) * 8)
+            {
+                nodeMask[options.m_NumaNode / bits] = 1UL << (options.m_NumaNode % bits);
+                result &= syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodeMask, sizeof(nodeMask) * 8) == 0;
+            }
+            else
+            {
+                result = false;
+            }
+            if (cpus.empty())
+            {
+                cpus = NodeCpus(options.m_NumaNode);
+            }
+        }
+        pthread_t self = pthread_self();
+        if (!cpus.empty())
+        {
+            result &= SetAffinity(self, cpus);
+        }
+        if (options.m_SchedPolicy >= 0)
+        {
+            result &= SetScheduling(self, options.m_SchedPolicy, options.m_Priority);
+        }
+        if (!options.m_Name.empty())
+        {
+            result &= SetName(self, options.m_Name);
+        }
+        return result;
+#else
+        return options.m_Cpus.empty() && options.m_NumaNode < 0 && options.m_SchedPolicy < 0 && options.m_Name.empty();
+#endif
+    }
+
+    /// One logical CPU for each physical core, the hyper-threading siblings are skipped
+    static std::vector<int> PhysicalCores()
+    {
+        std::vector<int> cores;
+#if defined(__linux__)
+        std::set<int> siblings;
+        for (int cpu : ParseCpuList(ReadFirstLine("/sys/devices/system/cpu/online")))
+        {
+            std::vector<int> threads = ParseCpuList(ReadFirstLine(
+                "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list"));
+            if (siblings.count(cpu) == 0)
+            {
+                cores.push_back(cpu);
+            }
+            siblings.insert(threads.begin(), threads.end());
+        }
+#endif
+        if (cores.empty())
+        {
+            for (uint32_t cpu = 0; cpu < std::max(HardwareConcurrency(), 1u); cpu++)
+            {
+                cores.push_back(cpu);
+            }
+        }
+        return cores;
+    }
+
+    /// CPUs belonging to a NUMA node, empty if the node is not known
+    static std::vector<int> NodeCpus(int node)
+    {
+#if defined(__linux__)
+        return ParseCpuList(ReadFirstLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+#else
+        (void)node;
+        return std::vector<int>();
+#endif
+    }
+
+    static void Wait(std::chrono::duration<double, std::milli> t) { std::this_thread::sleep_for(t); }
+
+#if defined(tInterruptibleThreadInstrumentation)
+    /// Collect the timings of a task running in the calling thread
+    class tTaskProbe
+    {
+    public:
+        tTaskProbe(const tInterruptionHandlerPtr& xInterrupHandler, int64_t queuedNs)
+            : m_xHandler(xInterrupHandler)
+        {
+            m_Record.m_TaskId = tTaskInstrumentation::NextTaskId();
+            m_Record.m_ThreadIndex = tTaskInstrumentation::ThreadIndex();
+            m_Record.m_QueuedNs = queuedNs;
+            m_Record.m_StartNs = tTaskInstrumentation::Now();
+            m_Record.m_CpuNs = tTaskInstrumentation::ThreadCpuTime();
+            m_Record.m_CheckPoints = m_xHandler ? m_xHandler->CheckPoints() : 0;
+        }
+
+        void Record()
+        {
+            m_Record.m_EndNs = tTaskInstrumentation::Now();
+            m_Record.m_CpuNs = tTaskInstrumentation::ThreadCpuTime() - m_Record.m_CpuNs;
+            m_Record.m_CheckPoints = m_xHandler ? m_xHandler->CheckPoints() - m_Record.m_CheckPoints : 0;
+            m_Record.m_InterruptLatencyNs = m_xHandler ? m_xHandler->InterruptLatencyNs() : -1;
+            tTaskInstrumentation::Record(m_Record);
+        }
+
+    private:
+        tInterruptionHandlerPtr m_xHandler;
+        tTaskInstrumentation::tTaskRecord m_Record;
+    };
+#endif
+
+private:
+    static bool SetAffinity(NativeHandleType handle, const std::vector<int>& cpus)
+    {
+#if defined(__linux__)
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for (int cpu : cpus)
+        {
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+            {
+                CPU_SET(cpu, &cpuSet);
+            }
+        }
+        return pthread_setaffinity_np(handle, sizeof(cpuSet), &cpuSet) == 0;
+#else
+        (void)handle;
+        return cpus.empty();
+#endif
+    }
+
+    static bool SetScheduling(NativeHandleType handle, int policy, int priority)
+    {
+#if defined(__linux__)
+        sched_param param = {};
+        param.sched_priority = priority;
+        return pthread_setschedparam(handle, policy, &param) == 0;
+#else
+        (void)handle; (void)policy; (void)priority;
+        return false;
+#endif
+    }
+
+    static bool SetName(NativeHandleType handle, const std::string& name)
+    {
+#if defined(__linux__)
+        return pthread_setname_np(handle, name.substr(0, 15).c_str()) == 0;
+#else
+        (void)handle; (void)name;
+        return false;
+#endif
+    }
+
+    static std::string ReadFirstLine(const std::string& path)
+    {
+        std::ifstream file(path);
+        std::string line;
+        std::getline(file, line);
+        return line;
+    }
+
+    /// Parse the kernel cpu list format, e.g. "0-3,8,10-11"
+    static std::vector<int> ParseCpuList(const std::string& list)
+    {
+        std::vector<int> cpus;
+        std::stringstream stream(list);
+        std::string range;
+        while (std::getline(stream, range, ','))
+        {
+            int first = 0;
+            int last = 0;
+            char dash = 0;
+            std::stringstream rangeStream(range);
+            if (!(rangeStream >> first))
+            {
+                continue;
+            }
+            last = (rangeStream >> dash >> last) ? last : first;
+            for (int cpu = first; cpu <= last; cpu++)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    struct tState
+    {
+        tState() : m_ExceptionPtr(nullptr) {}
+        std::exception_ptr m_ExceptionPtr;
+        tCompletionEvent m_Completion;
+#if defined(tInterruptibleThreadInstrumentation)
+        int64_t m_CreatedNs = tTaskInstrumentation::Now();
+#endif
+    };
+
+    void JoinImp()
+    {
+        if (!m_xState)
+        {
+            return;
+        }
+
+        // The task has completed when the event is set, the join only waits for
+        // the thread to exit, so nothing runs on its behalf after Join() returns
+        m_xState->m_Completion.Wait();
+        if (m_xThread->joinable())
+        {
+            m_xThread->join();
+        }
+    }
+
+    void RethrowException()
+    {
+        if (m_xState && m_xState->m_ExceptionPtr != nullptr)
+        {
+            std::rethrow_exception(m_xState->m_ExceptionPtr);
+        }
+    }
+
+    tInterruptionHandlerPtr m_Interruptionhandler;
+    std::shared_ptr<tState> m_xState;
+    std::unique_ptr<std::thread> m_xThread;
+    bool m_InterruptOnDestruction = false;
+};
+
+/// Pool of tInterruptibleThread workers. Every worker owns a deque of tasks:
+/// it pops from the back of its own deque and, when empty, steals from the
+/// front of the other workers' deques.
+class tInterruptibleThreadPool
+{
+public:
+    using tInterruptionHandler = tInterruptibleThread::tInterruptionHandler;
+    using tInterruptionHandlerPtr = tInterruptibleThread::tInterruptionHandlerPtr;
+
+    /// Handle returned by Submit(), Join() rethrows the exception thrown by the task
+    class tTask
+    {
+    public:
+        tTask() noexcept = default;
+
+        bool Valid() const noexcept { return (bool)m_xState; }
+
+        bool Ready() const noexcept { return m_xState->m_Completion.IsSet(); }
+
+        /// Called from a pool worker, the pending tasks of its pool are run while
+        /// waiting, so a task can join the tasks it submitted even on one worker
+        void Join()
+        {
+            tInterruptibleThreadPool* pPool = CurrentWorker().m_pPool;
+            if (pPool != nullptr)
+            {
+                pPool->Help(m_xState->m_Completion);
+            }
+            m_xState->m_Completion.Wait();
+
+            if (m_xState->m_ExceptionPtr != nullptr)
+            {
+                std::rethrow_exception(m_xState->m_ExceptionPtr);
+            }
+        }
+
+        /// Does not run other tasks while waiting, unlike Join()
+        template <typename Rep, typename Period>
+        bool JoinFor(const std::chrono::duration<Rep, Period>& t)
+        {
+            if (!m_xState->m_Completion.WaitFor(t))
+            {
+                return false;
+            }
+            Join();
+            return true;
+        }
+
+        tInterruptionHandlerPtr InterruptionHandler() { return m_xState->m_Interruptionhandler; }
+
+        void Interrupt()
+        {
+            if (m_xState->m_Interruptionhandler)
+            {
+                m_xState->m_Interruptionhandler->Interrupt();
+            }
+        }
+
+    private:
+        friend class tInterruptibleThreadPool;
+
+        struct tState
+        {
+            tState(tInterruptionHandlerPtr xInterrupHandler)
+                : m_ExceptionPtr(nullptr)
+                , m_Interruptionhandler(xInterrupHandler)
+            {}
+            std::exception_ptr m_ExceptionPtr;
+            tInterruptionHandlerPtr m_Interruptionhandler;
+            tInterruptibleThread::tCompletionEvent m_Completion;
+        };
+
+        tTask(std::shared_ptr<tState> xState) : m_xState(xState) {}
+
+        std::shared_ptr<tState> m_xState;
+    };
+
+    using tThreadOptions = tInterruptibleThread::tThreadOptions;
+
+    explicit tInterruptibleThreadPool(uint32_t threads = tInterruptibleThread::HardwareConcurrency())
+        : m_Pending(0)
+        , m_Sleepers(0)
+        , m_Next(0)
+        , m_UnhandledExceptions(0)
+        , m_Stop(false)
+    {
+        Start(std::vector<tThreadOptions>(std::max(threads, 1u)));
+    }
+
+    /// One worker pinned on each physical core. The CPU set of the options is
+    /// replaced by the core, the name gets the worker index as suffix.
+    explicit tInterruptibleThreadPool(const tThreadOptions& options)
+        : m_Pending(0)
+        , m_Sleepers(0)
+        , m_Next(0)
+        , m_UnhandledExceptions(0)
+        , m_Stop(false)
+    {
+        std::vector<int> cores = tInterruptibleThread::PhysicalCores();
+        if (options.m_NumaNode >= 0)
+        {
+            std::vector<int> nodeCpus = tInterruptibleThread::NodeCpus(options.m_NumaNode);
+            std::vector<int> nodeCores;
+            std::copy_if(cores.begin(), cores.end(), std::back_inserter(nodeCores),
+                         [&](int core) { return std::find(nodeCpus.begin(), nodeCpus.end(), core) != nodeCpus.end(); });
+            if (!nodeCores.empty())
+            {
+                cores.swap(nodeCores);
+            }
+        }
+
+        std::vector<tThreadOptions> workerOptions(cores.size(), options);
+        for (size_t i = 0; i < cores.size(); i++)
+        {
+            workerOptions[i].m_Cpus.assign(1, cores[i]);
+            if (!options.m_Name.empty())
+            {
+                workerOptions[i].m_Name = options.m_Name + "-" + std::to_string(i);
+            }
+        }
+        Start(workerOptions);
+    }
+
+    /// Pending tasks are executed before the workers are joined
+    ~tInterruptibleThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Stop = true;
+        }
+        m_Condition.notify_all();
+
+        for (auto& xWorker : m_Workers)
+        {
+            xWorker->Join();
+        }
+    }
+
+    tInterruptibleThreadPool(const tInterruptibleThreadPool&) = delete;
+    tInterruptibleThreadPool& operator=(const tInterruptibleThreadPool&) = delete;
+
+    /// Enqueue f(xInterrupHandler, args...), the same signature used by tInterruptibleThread
+    template <typename Callable, typename... Args>
+    tTask Submit(Callable&& f, tInterruptionHandlerPtr xInterrupHandler, Args&&... args)
+    {
+        auto xState = std::make_shared<tTask::tState>(xInterrupHandler);
+        auto bound = std::bind(std::forward<Callable>(f), xInterrupHandler, std::forward<Args>(args)...);
+#if defined(tInterruptibleThreadInstrumentation)
+        int64_t queuedNs = tTaskInstrumentation::Now();
+#endif
+
+        Push([=]() mutable
+        {
+#if defined(tInterruptibleThreadInstrumentation)
+            tInterruptibleThread::tTaskProbe probe(xState->m_Interruptionhandler, queuedNs);
+#endif
+            try
+            {
+                // The task could be interrupted while it was waiting in the queue
+                if (xState->m_Interruptionhandler)
+                {
+                    xState->m_Interruptionhandler->InterruptionCheckPoint();
+                }
+                bound();
+            }
+            catch (...)
+            {
+                xState->m_ExceptionPtr = std::current_exception();
+            }
+#if defined(tInterruptibleThreadInstrumentation)
+            probe.Record();
+#endif
+            xState->m_Completion.Set();
+        });
+
+        return tTask(xState);
+    }
+
+    /// Enqueue a task without completion handle. An exception thrown by the task
+    /// has nowhere to go: it is dropped and counted by UnhandledExceptions(), the
+    /// worker keeps running
+    void Execute(std::function<void()> task) { Push(std::move(task)); }
+
+    size_t Size() const noexcept { return m_Workers.size(); }
+
+    /// Exceptions thrown by the tasks of Execute() and dropped
+    size_t UnhandledExceptions() const noexcept { return m_UnhandledExceptions.load(std::memory_order_relaxed); }
+
+private:
+    void Start(const std::vector<tThreadOptions>& workerOptions)
+    {
+        for (size_t i = 0; i < workerOptions.size(); i++)
+        {
+            m_Queues.emplace_back(new tWorkQueue());
+        }
+
+        auto worker = [this](tInterruptionHandlerPtr, size_t index) { WorkerLoop(index); };
+        for (size_t i = 0; i < workerOptions.size(); i++)
+        {
+            m_Workers.emplace_back(new tInterruptibleThread(workerOptions[i], false, worker, std::make_shared<tInterruptionHandler>(), i));
+        }
+    }
+
+    struct tWorkQueue
+    {
+        std::mutex m_Mutex;
+        std::deque<std::function<void()>> m_Tasks;
+    };
+
+    struct tWorkerSlot
+    {
+        tInterruptibleThreadPool* m_pPool = nullptr;
+        size_t m_Index = 0;
+    };
+
+    static tWorkerSlot& CurrentWorker()
+    {
+        static thread_local tWorkerSlot slot;
+        return slot;
+    }
+
+    void Push(std::function<void()>&& task)
+    {
+        // Tasks submitted from a worker go to its own deque, the others are spread round robin
+        const tWorkerSlot& slot = CurrentWorker();
+        size_t index = (slot.m_pPool == this) ? slot.m_Index : m_Next++ % m_Queues.size();
+        {
+            // The counter is updated under the deque mutex, as in Pop(), so it never
+            // counts a task that has already been popped
+            std::lock_guard<std::mutex> lock(m_Queues[index]->m_Mutex);
+            m_Queues[index]->m_Tasks.push_back(std::move(task));
+            m_Pending++;
+        }
+        // A worker registers itself before checking m_Pending, so either it sees the
+        // new task or it is seen here. The pool mutex is taken only if one is parked.
+        if (m_Sleepers.load() != 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+            }
+            m_Condition.notify_one();
+        }
+    }
+
+    bool Pop(size_t index, std::function<void()>& task)
+    {
+        {
+            tWorkQueue& queue = *m_Queues[index];
+            std::lock_guard<std::mutex> lock(queue.m_Mutex);
+            if (!queue.m_Tasks.empty())
+            {
+                task = std::move(queue.m_Tasks.back());
+                queue.m_Tasks.pop_back();
+                m_Pending--;
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < m_Queues.size(); i++)
+        {
+            tWorkQueue& victim = *m_Queues[(index + i) % m_Queues.size()];
+            std::lock_guard<std::mutex> lock(victim.m_Mutex);
+            if (!victim.m_Tasks.empty())
+            {
+                task = std::move(victim.m_Tasks.front());
+                victim.m_Tasks.pop_front();
+                m_Pending--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkerLoop(size_t index)
+    {
+        CurrentWorker().m_pPool = this;
+        CurrentWorker().m_Index = index;
+
+        std::function<void()> task;
+        for (;;)
+        {
+            if (Pop(index, task))
+            {
+                Run(task);
+                continue;
+            }
+
+            m_Sleepers++;
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            if (m_Stop && m_Pending == 0)
+            {
+                m_Sleepers--;
+                break;
+            }
+            m_Condition.wait(lock, [&] { return m_Stop || m_Pending > 0; });
+            m_Sleepers--;
+        }
+
+        CurrentWorker().m_pPool = nullptr;
+    }
+
+    void Run(std::function<void()>& task) noexcept
+    {
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            m_UnhandledExceptions++;
+        }
+        task = nullptr;
+    }
+
+    /// Run the pending tasks from the calling worker until the event is set. When
+    /// the deques are empty the awaited task is running on another worker.
+    void Help(const tInterruptibleThread::tCompletionEvent& completion)
+    {
+        size_t index = CurrentWorker().m_Index;
+        std::function<void()> task;
+        while (!completion.IsSet() && Pop(index, task))
+        {
+            Run(task);
+        }
+    }
+
+    std::vector<std::unique_ptr<tWorkQueue>> m_Queues;
+    std::vector<std::unique_ptr<tInterruptibleThread>> m_Workers;
+    std::condition_variable m_Condition;
+    std::mutex m_Mutex;
+    std::atomic<size_t> m_Pending;   // Tasks in the deques, updated under their mutexes
+    std::atomic<uint32_t> m_Sleepers;  // Workers parked, or about to park, on m_Condition
+    std::atomic<size_t> m_Next;
+    std::atomic<size_t> m_UnhandledExceptions;
+    bool m_Stop;
+};
+
+/// Bounded lock-free multi-producer multi-consumer channel (D. Vyukov's bounded queue).
+/// Every cell carries a sequence number telling whether it can be written or read
+/// at a given position, so producers and consumers only contend on the position
+/// counters. The blocking Push()/Pop() park on a condition variable through the
+/// tInterruptionHandler, so they wake up and throw tException when interrupted.
+/// The batch operations claim several consecutive cells with a single CAS.
+/// A claimed cell is always published: T must be nothrow move constructible, and a
+/// value whose copy or conversion can throw is built before claiming the cell.
+/// Only Pop() requires a default constructible T.
+template <typename T>
+class tInterruptibleChannel
+{
+    static_assert(std::is_nothrow_move_constructible<T>::value,
+                  "tInterruptibleChannel requires a nothrow move constructible type: a throw after claiming a cell would stall the consumers");
+
+public:
+    using tInterruptionHandlerPtr = tInterruptibleThread::tInterruptionHandlerPtr;
+
+    /// The capacity is rounded up to a power of two
+    explicit tInterruptibleChannel(size_t capacity)
+        : m_Mask(RoundUp(capacity) - 1)
+        , m_xCells(new tCell[m_Mask + 1])
+        , m_EnqueuePos(0)
+        , m_DequeuePos(0)
+        , m_PushWaiters(0)
+        , m_PopWaiters(0)
+    {
+        for (size_t i = 0; i <= m_Mask; i++)
+        {
+            m_xCells[i].m_Sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~tInterruptibleChannel()
+    {
+        // No concurrent operations, every claimed cell has been published
+        size_t end = m_EnqueuePos.load(std::memory_order_relaxed);
+        for (size_t pos = m_DequeuePos.load(std::memory_order_relaxed); pos != end; pos++)
+        {
+            reinterpret_cast<T*>(&m_xCells[pos & m_Mask].m_Storage)->~T();
+        }
+    }
+
+    tInterruptibleChannel(const tInterruptibleChannel&) = delete;
+    tInterruptibleChannel& operator=(const tInterruptibleChannel&) = delete;
+
+    size_t Capacity() const noexcept { return m_Mask + 1; }
+
+    /// The value is moved from only if it is pushed, unless T cannot be built from it
+    /// without throwing: it is then converted first and the copy is dropped if full
+    template <typename U>
+    bool TryPush(U&& value)
+    {
+        return TryPushImp(std::forward<U>(value), std::integral_constant<bool, std::is_nothrow_constructible<T, U&&>::value>());
+    }
+
+private:
+    template <typename U>
+    bool TryPushImp(U&& value, std::false_type)
+    {
+        T item(std::forward<U>(value));
+        return TryPushImp(std::move(item), std::true_type());
+    }
+
+    template <typename U>
+    bool TryPushImp(U&& value, std::true_type)
+    {
+        size_t pos = m_EnqueuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            tCell& cell = m_xCells[pos & m_Mask];
+            size_t sequence = cell.m_Sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (m_EnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    new (&cell.m_Storage) T(std::forward<U>(value));
+                    cell.m_Sequence.store(pos + 1, std::memory_order_release);
+                    NotifyPop();
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;  // Full
+            }
+            else
+            {
+                pos = m_EnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+public:
+    bool TryPop(T& value)
+    {
+        size_t pos = m_DequeuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            tCell& cell = m_xCells[pos & m_Mask];
+            size_t sequence = cell.m_Sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (m_DequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    Take(cell, value, pos);
+                    NotifyPush();
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;  // Empty
+            }
+            else
+            {
+                pos = m_DequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// Move up to count values from first, returns the number of values pushed
+    template <typename Iterator>
+    size_t TryPushBatch(Iterator first, size_t count)
+    {
+        size_t pos = m_EnqueuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            size_t ready = 0;
+            while (ready < count && m_xCells[(pos + ready) & m_Mask].m_Sequence.load(std::memory_order_acquire) == pos + ready)
+            {
+                ready++;
+            }
+            if (ready == 0)
+            {
+                size_t current = m_EnqueuePos.load(std::memory_order_relaxed);
+                if (current == pos)
+                {
+                    return 0;  // Full
+                }
+                pos = current;
+                continue;
+            }
+            // The cells found free cannot be claimed by others until the position moves
+            if (m_EnqueuePos.compare_exchange_weak(pos, pos + ready, std::memory_order_relaxed))
+            {
+                for (size_t i = 0; i < ready; i++, ++first)
+                {
+                    tCell& cell = m_xCells[(pos + i) & m_Mask];
+                    new (&cell.m_Storage) T(std::move(*first));
+                    cell.m_Sequence.store(pos + i + 1, std::memory_order_release);
+                }
+                NotifyPop();
+                return ready;
+            }
+        }
+    }
+
+    /// Pop up to maxCount values into out, returns the number of values popped
+    template <typename OutputIterator>
+    size_t TryPopBatch(OutputIterator out, size_t maxCount)
+    {
+        size_t pos = m_DequeuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            size_t ready = 0;
+            while (ready < maxCount && m_xCells[(pos + ready) & m_Mask].m_Sequence.load(std::memory_order_acquire) == pos + ready + 1)
+            {
+                ready++;
+            }
+            if (ready == 0)
+            {
+                size_t current = m_DequeuePos.load(std::memory_order_relaxed);
+                if (current == pos)
+                {
+                    return 0;  // Empty
+                }
+                pos = current;
+                continue;
+            }
+            if (m_DequeuePos.compare_exchange_weak(pos, pos + ready, std::memory_order_relaxed))
+            {
+                for (size_t i = 0; i < ready; i++, ++out)
+                {
+                    Take(m_xCells[(pos + i) & m_Mask], *out, pos + i);
+                }
+                NotifyPush();
+                return ready;
+            }
+        }
+    }
+
+    /// Blocking push, throws tException if the handler is interrupted while waiting
+    template <typename U>
+    void Push(U&& value, const tInterruptionHandlerPtr& xInterrupHandler)
+    {
+        // Converted once, TryPush() would copy it again on every retry
+        T item(std::forward<U>(value));
+        while (!TryPush(std::move(item)))
+        {
+            WaitFor(m_PushWaiters, m_NotFull, xInterrupHandler, [&] { return CanPush(); });
+        }
+    }
+
+    /// Blocking pop, throws tException if the handler is interrupted while waiting.
+    /// T must be default constructible, TryPop() and PopBatch() do not require it
+    T Pop(const tInterruptionHandlerPtr& xInterrupHandler)
+    {
+        T value;
+        while (!TryPop(value))
+        {
+            WaitFor(m_PopWaiters, m_NotEmpty, xInterrupHandler, [&] { return CanPop(); });
+        }
+        return value;
+    }
+
+    /// Push all the values in [first, last), blocking while the channel is full
+    template <typename Iterator>
+    void PushBatch(Iterator first, Iterator last, const tInterruptionHandlerPtr& xInterrupHandler)
+    {
+        size_t count = std::distance(first, last);
+        while (count > 0)
+        {
+            size_t pushed = TryPushBatch(first, count);
+            if (pushed == 0)
+            {
+                WaitFor(m_PushWaiters, m_NotFull, xInterrupHandler, [&] { return CanPush(); });
+            }
+            std::advance(first, pushed);
+            count -= pushed;
+        }
+    }
+
+    /// Pop at least one and up to maxCount values, blocking while the channel is empty
+    template <typename OutputIterator>
+    size_t PopBatch(OutputIterator out, size_t maxCount, const tInterruptionHandlerPtr& xInterrupHandler)
+    {
+        for (;;)
+        {
+            size_t popped = TryPopBatch(out, maxCount);
+            if (popped > 0 || maxCount == 0)
+            {
+                return popped;
+            }
+            WaitFor(m_PopWaiters, m_NotEmpty, xInterrupHandler, [&] { return CanPop(); });
+        }
+    }
+
+private:
+    struct tCell
+    {
+        std::atomic<size_t> m_Sequence;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type m_Storage;
+    };
+
+    static const size_t CacheLineSize = 64;
+
+    static size_t RoundUp(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    /// Move the value of the cell to destination and release the cell, even if the
+    /// assignment throws: the value is then lost but the producers do not stall
+    template <typename Destination>
+    void Take(tCell& cell, Destination&& destination, size_t pos)
+    {
+        struct tRelease
+        {
+            ~tRelease()
+            {
+                m_pValue->~T();
+                m_Cell.m_Sequence.store(m_Sequence, std::memory_order_release);
+            }
+            tCell& m_Cell;
+            T* m_pValue;
+            size_t m_Sequence;
+        } release{ cell, reinterpret_cast<T*>(&cell.m_Storage), pos + m_Mask + 1 };
+        destination = std::move(*release.m_pValue);
+    }
+
+    bool CanPush() const
+    {
+        size_t pos = m_EnqueuePos.load(std::memory_order_relaxed);
+        return m_xCells[pos & m_Mask].m_Sequence.load(std::memory_order_acquire) == pos;
+    }
+
+    bool CanPop() const
+    {
+        size_t pos = m_DequeuePos.load(std::memory_order_relaxed);
+        return m_xCells[pos & m_Mask].m_Sequence.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    // The mutex is touched only when there are blocked threads. The waiter count is
+    // updated before checking the channel and read after changing it, so either the
+    // waiter sees the change or the notifier sees the waiter.
+    void NotifyPop() { Notify(m_PopWaiters, m_NotEmpty); }
+    void NotifyPush() { Notify(m_PushWaiters, m_NotFull); }
+
+    void Notify(std::atomic<uint32_t>& waiters, std::condition_variable& condition)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) != 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+            }
+            condition.notify_all();
+        }
+    }
+
+    template <typename Predicate>
+    void WaitFor(std::atomic<uint32_t>& waiters, std::condition_variable& condition,
+                 const tInterruptionHandlerPtr& xInterrupHandler, Predicate pred)
+    {
+        // Short spin before parking, the other side is often about to complete
+        for (int i = 0; i < 64; i++)
+        {
+            if (pred())
+            {
+                return;
+            }
+            std::this_thread::yield();
+        }
+
+        struct tWaiterGuard
+        {
+            explicit tWaiterGuard(std::atomic<uint32_t>& waiters) : m_Waiters(waiters) { m_Waiters++; }
+            ~tWaiterGuard() { m_Waiters--; }
+            std::atomic<uint32_t>& m_Waiters;
+        } guard(waiters);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        if (xInterrupHandler)
+        {
+            xInterrupHandler->Wait(condition, lock, pred);
+        }
+        else
+        {
+            condition.wait(lock, pred);
+        }
+    }
+
+    const size_t m_Mask;
+    std::unique_ptr<tCell[]> m_xCells;
+    // Producers and consumers update their position on separate cache lines
+    alignas(CacheLineSize) std::atomic<size_t> m_EnqueuePos;
+    alignas(CacheLineSize) std::atomic<size_t> m_DequeuePos;
+    alignas(CacheLineSize) std::atomic<uint32_t> m_PushWaiters;
+    std::atomic<uint32_t> m_PopWaiters;
+    std::condition_variable m_NotFull;
+    std::condition_variable m_NotEmpty;
+    std::mutex m_Mutex;
+};
+
+/// Delayed and periodic tasks executed on the workers of a tInterruptibleThreadPool.
+/// The pending tasks are kept in a hierarchical timing wheel (4 levels of 256 slots,
+/// one tick per slot of the first level), so scheduling and cancelling are O(1)
+/// and a single thread advances the wheel for all of them. A task whose handler is
+/// interrupted is dropped when it expires; Cancel() also unlinks it immediately.
+/// The executor must outlive the scheduler.
+class tInterruptibleScheduler
+{
+public:
+    using tInterruptionHandlerPtr = tInterruptibleThread::tInterruptionHandlerPtr;
+
+private:
+    class tWheel;
+
+    struct tTimer
+    {
+        tTimer* m_pPrev = nullptr;
+        tTimer* m_pNext = nullptr;
+        tTimer** m_pSlot = nullptr;
+        std::shared_ptr<tTimer> m_xSelf;  // Reference held by the wheel while the timer is linked
+        uint64_t m_Expiry = 0;
+        uint64_t m_PeriodTicks = 0;       // 0 for one shot tasks
+        std::atomic<bool> m_Cancelled{ false };  // Set under the wheel mutex, never added again once set
+        std::function<void()> m_Task;
+        tInterruptionHandlerPtr m_xInterruptionHandler;
+        std::weak_ptr<tWheel> m_xWheel;
+    };
+
+public:
+    /// Handle of a scheduled task
+    class tScheduledTask
+    {
+    public:
+        tScheduledTask() noexcept = default;
+
+        bool Valid() const noexcept { return (bool)m_xTimer; }
+
+        /// Remove the task from the wheel and interrupt the running instance, if any
+        void Cancel()
+        {
+            if (auto xWheel = m_xTimer->m_xWheel.lock())
+            {
+                xWheel->Cancel(m_xTimer);
+            }
+            Interrupt();
+        }
+
+        void Interrupt()
+        {
+            if (m_xTimer->m_xInterruptionHandler)
+            {
+                m_xTimer->m_xInterruptionHandler->Interrupt();
+            }
+        }
+
+        tInterruptionHandlerPtr InterruptionHandler() { return m_xTimer->m_xInterruptionHandler; }
+
+    private:
+        friend class tInterruptibleScheduler;
+        explicit tScheduledTask(std::shared_ptr<tTimer> xTimer) : m_xTimer(xTimer) {}
+        std::shared_ptr<tTimer> m_xTimer;
+    };
+
+    explicit tInterruptibleScheduler(tInterruptibleThreadPool& executor, std::chrono::milliseconds tick = std::chrono::milliseconds(1))
+        : m_xWheel(std::make_shared<tWheel>(executor, tick))
+    {
+        std::shared_ptr<tWheel> xWheel = m_xWheel;
+        m_xTicker.reset(new tInterruptibleThread(false, [xWheel](tInterruptionHandlerPtr) { xWheel->Run(); },
+                                                 std::make_shared<tInterruptibleThread::tInterruptionHandler>()));
+    }
+
+    ~tInterruptibleScheduler()
+    {
+        m_xWheel->Stop();
+        m_xTicker->Join();
+        m_xWheel->Clear();
+    }
+
+    tInterruptibleScheduler(const tInterruptibleScheduler&) = delete;
+    tInterruptibleScheduler& operator=(const tInterruptibleScheduler&) = delete;
+
+    /// Run f(xInterrupHandler, args...) once after the delay
+    template <typename Rep, typename Period, typename Callable, typename... Args>
+    tScheduledTask ScheduleAfter(const std::chrono::duration<Rep, Period>& delay, Callable&& f, tInterruptionHandlerPtr xInterrupHandler, Args&&... args)
+    {
+        return Schedule(delay, std::chrono::milliseconds(0),
+                        std::bind(std::forward<Callable>(f), xInterrupHandler, std::forward<Args>(args)...), xInterrupHandler);
+    }
+
+    /// Run f(xInterrupHandler, args...) after the delay and then again a period after
+    /// the end of each run, until the task is cancelled, interrupted or throws
+    template <typename Rep1, typename Period1, typename Rep2, typename Period2, typename Callable, typename... Args>
+    tScheduledTask ScheduleEvery(const std::chrono::duration<Rep1, Period1>& delay, const std::chrono::duration<Rep2, Period2>& period,
+                                 Callable&& f, tInterruptionHandlerPtr xInterrupHandler, Args&&... args)
+    {
+        return Schedule(delay, std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(period), std::chrono::nanoseconds(1)),
+                        std::bind(std::forward<Callable>(f), xInterrupHandler, std::forward<Args>(args)...), xInterrupHandler);
+    }
+
+    size_t Pending() const { return m_xWheel->Pending(); }
+
+private:
+    template <typename Rep1, typename Period1, typename Rep2, typename Period2>
+    tScheduledTask Schedule(const std::chrono::duration<Rep1, Period1>& delay, const std::chrono::duration<Rep2, Period2>& period,
+                            std::function<void()> task, tInterruptionHandlerPtr xInterrupHandler)
+    {
+        auto xTimer = std::make_shared<tTimer>();
+        xTimer->m_Task = std::move(task);
+        xTimer->m_xInterruptionHandler = xInterrupHandler;
+        xTimer->m_xWheel = m_xWheel;
+        xTimer->m_PeriodTicks = m_xWheel->Ticks(period);
+        m_xWheel->Add(xTimer, m_xWheel->Ticks(delay));
+        return tScheduledTask(xTimer);
+    }
+
+    class tWheel
+    {
+    public:
+        static const int LevelBits = 8;
+        static const int Levels = 4;
+        static const uint64_t SlotCount = 1 << LevelBits;
+        static const uint64_t SlotMask = SlotCount - 1;
+
+        tWheel(tInterruptibleThreadPool& executor, std::chrono::milliseconds tick)
+            : m_Executor(executor)
+            , m_Tick(std::max(std::chrono::duration_cast<std::chrono::steady_clock::duration>(tick), std::chrono::steady_clock::duration(1)))
+            , m_Start(std::chrono::steady_clock::now())
+            , m_CurrentTick(0)
+            , m_WakeTick(std::numeric_limits<uint64_t>::max())
+            , m_Pending(0)
+            , m_Stop(false)
+        {
+            for (auto& level : m_Slots)
+            {
+                for (auto& slot : level)
+                {
+                    slot = nullptr;
+                }
+            }
+        }
+
+        template <typename Rep, typename Period>
+        uint64_t Ticks(const std::chrono::duration<Rep, Period>& t) const
+        {
+            auto duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(t);
+            return duration.count() <= 0 ? 0 : (uint64_t)((duration + m_Tick - std::chrono::steady_clock::duration(1)) / m_Tick);
+        }
+
+        void Add(const std::shared_ptr<tTimer>& xTimer, uint64_t delayTicks)
+        {
+            bool wake = false;
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                if (m_Stop || xTimer->m_Cancelled)
+                {
+                    return;
+                }
+                // The wheel could be behind the clock if the ticker has not run yet
+                uint64_t now = std::max(m_CurrentTick, ElapsedTicks());
+                xTimer->m_Expiry = std::max(now + std::max<uint64_t>(delayTicks, 1), m_CurrentTick + 1);
+                xTimer->m_xSelf = xTimer;
+                Link(xTimer.get());
+                m_Pending++;
+                wake = xTimer->m_Expiry < m_WakeTick;
+                if (wake)
+                {
+                    m_WakeTick = xTimer->m_Expiry;
+                }
+            }
+            // The ticker sleeps until the next occupied slot, or without timeout when
+            // the wheel is empty
+            if (wake)
+            {
+                m_Condition.notify_one();
+            }
+        }
+
+        void Cancel(const std::shared_ptr<tTimer>& xTimer)
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            xTimer->m_Cancelled = true;
+            if (xTimer->m_xSelf)
+            {
+                Unlink(xTimer.get());
+                m_Pending--;
+                xTimer->m_xSelf.reset();
+            }
+        }
+
+        size_t Pending() const
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            return m_Pending;
+        }
+
+        void Stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                m_Stop = true;
+            }
+            m_Condition.notify_one();
+        }
+
+        /// Release the references of the linked timers, called once the ticker is stopped
+        void Clear()
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            for (auto& level : m_Slots)
+            {
+                for (auto& slot : level)
+                {
+                    while (slot)
+                    {
+                        tTimer* pTimer = slot;
+                        Unlink(pTimer);
+                        pTimer->m_xSelf.reset();
+                    }
+                }
+            }
+            m_Pending = 0;
+        }
+
+        void Run()
+        {
+            std::vector<std::shared_ptr<tTimer>> expired;
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            while (!m_Stop)
+            {
+                if (m_Pending == 0)
+                {
+                    m_WakeTick = std::numeric_limits<uint64_t>::max();
+                    m_Condition.wait(lock);
+                    continue;
+                }
+
+                uint64_t target = ElapsedTicks();
+                uint64_t next = NextEventTick();
+                if (target < next)
+                {
+                    m_WakeTick = next;
+                    m_Condition.wait_until(lock, m_Start + m_Tick * next);
+                    continue;
+                }
+                m_WakeTick = std::numeric_limits<uint64_t>::max();
+
+                while (m_CurrentTick < target)
+                {
+                    Advance(expired);
+                }
+                m_Pending -= expired.size();
+
+                lock.unlock();
+                for (auto& xTimer : expired)
+                {
+                    Dispatch(xTimer);
+                }
+                expired.clear();
+                lock.lock();
+            }
+        }
+
+    private:
+        uint64_t ElapsedTicks() const { return (uint64_t)((std::chrono::steady_clock::now() - m_Start) / m_Tick); }
+
+        /// First tick to be processed: the next occupied slot of the first level,
+        /// or the next cascade of the upper levels if the slots before it are empty
+        uint64_t NextEventTick() const
+        {
+            uint64_t cascade = (m_CurrentTick | SlotMask) + 1;
+            for (uint64_t tick = m_CurrentTick + 1; tick < cascade; tick++)
+            {
+                if (m_Slots[0][tick & SlotMask])
+                {
+                    return tick;
+                }
+            }
+            return cascade;
+        }
+
+        void Link(tTimer* pTimer)
+        {
+            uint64_t expiry = pTimer->m_Expiry;
+            uint64_t delta = expiry - m_CurrentTick;
+            int level = 0;
+            while (level < Levels - 1 && delta >= ((uint64_t)1 << (LevelBits * (level + 1))))
+            {
+                level++;
+            }
+            // Beyond the last level the timer is parked in its furthest slot and cascaded again later
+            if (level == Levels - 1 && delta >= ((uint64_t)1 << (LevelBits * Levels)))
+            {
+                expiry = m_CurrentTick + ((uint64_t)1 << (LevelBits * Levels)) - 1;
+            }
+            tTimer*& head = m_Slots[level][(expiry >> (LevelBits * level)) & SlotMask];
+            pTimer->m_pPrev = nullptr;
+            pTimer->m_pNext = head;
+            if (head)
+            {
+                head->m_pPrev = pTimer;
+            }
+            head = pTimer;
+            pTimer->m_pSlot = &head;
+        }
+
+        void Unlink(tTimer* pTimer)
+        {
+            if (pTimer->m_pPrev)
+            {
+                pTimer->m_pPrev->m_pNext = pTimer->m_pNext;
+            }
+            else
+            {
+                *pTimer->m_pSlot = pTimer->m_pNext;
+            }
+            if (pTimer->m_pNext)
+            {
+                pTimer->m_pNext->m_pPrev = pTimer->m_pPrev;
+            }
+            pTimer->m_pPrev = pTimer->m_pNext = nullptr;
+            pTimer->m_pSlot = nullptr;
+        }
+
+        /// Move the timers of a slot of an upper level to the lower levels
+        void Cascade(int level)
+        {
+            uint64_t index = (m_CurrentTick >> (LevelBits * level)) & SlotMask;
+            if (index == 0 && level + 1 < Levels)
+            {
+                Cascade(level + 1);
+            }
+            tTimer* pTimer = m_Slots[level][index];
+            m_Slots[level][index] = nullptr;
+            while (pTimer)
+            {
+                tTimer* pNext = pTimer->m_pNext;
+                Link(pTimer);
+                pTimer = pNext;
+            }
+        }
+
+        void Advance(std::vector<std::shared_ptr<tTimer>>& expired)
+        {
+            m_CurrentTick++;
+            if ((m_CurrentTick & SlotMask) == 0)
+            {
+                Cascade(1);
+            }
+            tTimer*& head = m_Slots[0][m_CurrentTick & SlotMask];
+            while (head)
+            {
+                tTimer* pTimer = head;
+                Unlink(pTimer);
+                expired.push_back(std::move(pTimer->m_xSelf));
+            }
+        }
+
+        void Dispatch(const std::shared_ptr<tTimer>& xTimer)
+        {
+            if (xTimer->m_Cancelled || (xTimer->m_xInterruptionHandler && xTimer->m_xInterruptionHandler->Interrupted()))
+            {
+                return;
+            }
+
+            // The worker keeps only a weak reference to the wheel, that could be destroyed meanwhile
+            m_Executor.Execute([xTimer]()
+            {
+                try
+                {
+                    if (xTimer->m_xInterruptionHandler)
+                    {
+                        xTimer->m_xInterruptionHandler->InterruptionCheckPoint();
+                    }
+                    xTimer->m_Task();
+                }
+                catch (...)
+                {
+                    return;
+                }
+
+                // Add() drops the timer if it has been cancelled while running
+                auto xWheel = xTimer->m_xWheel.lock();
+                if (xWheel && xTimer->m_PeriodTicks > 0 && !xTimer->m_Cancelled)
+                {
+                    xWheel->Add(xTimer, xTimer->m_PeriodTicks);
+                }
+            });
+        }
+
+        tInterruptibleThreadPool& m_Executor;
+        const std::chrono::steady_clock::duration m_Tick;
+        const std::chrono::steady_clock::time_point m_Start;
+        tTimer* m_Slots[Levels][SlotCount];
+        uint64_t m_CurrentTick;
+        uint64_t m_WakeTick;  // Tick the ticker sleeps until
+        size_t m_Pending;
+        bool m_Stop;
+        std::condition_variable m_Condition;
+        mutable std::mutex m_Mutex;
+    };
+
+    std::shared_ptr<tWheel> m_xWheel;
+    std::unique_ptr<tInterruptibleThread> m_xTicker;
+};
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <optional>
+#define INTERRUPTIBLE_COROUTINE_SUPPORTED
+
+/// Common part of the tInterruptibleCoroutine promises: the interruption handler,
+/// the executor the coroutine is resumed on and the completion state.
+class tInterruptibleCoroutinePromiseBase
+{
+public:
+    using tInterruptionHandlerPtr = tInterruptibleThread::tInterruptionHandlerPtr;
+
+    tInterruptibleCoroutinePromiseBase() = default;
+
+    /// Coroutine functions f(handler, args...) use the handler of their first parameter
+    template <typename... Args>
+    tInterruptibleCoroutinePromiseBase(tInterruptionHandlerPtr xInterrupHandler, Args&...)
+        : m_xInterruptionHandler(xInterrupHandler)
+    {}
+
+    /// Coroutine member functions object.f(handler, args...)
+    template <typename Object, typename... Args>
+    tInterruptibleCoroutinePromiseBase(Object&, tInterruptionHandlerPtr xInterrupHandler, Args&...)
+        : m_xInterruptionHandler(xInterrupHandler)
+    {}
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { m_ExceptionPtr = std::current_exception(); }
+
+    /// Every co_await is an interruption checkpoint
+    template <typename Awaitable>
+    Awaitable&& await_transform(Awaitable&& awaitable)
+    {
+        CheckPoint();
+        return std::forward<Awaitable>(awaitable);
+    }
+
+    void CheckPoint()
+    {
+        if (m_xInterruptionHandler)
+        {
+            m_xInterruptionHandler->InterruptionCheckPoint();
+        }
+    }
+
+    /// Resume the coroutine on its executor, or inline when it has none
+    void Post(std::coroutine_handle<> handle)
+    {
+        if (m_pExecutor)
+        {
+            m_pExecutor->Execute([handle]() { handle.resume(); });
+        }
+        else
+        {
+            handle.resume();
+        }
+    }
+
+    tInterruptionHandlerPtr m_xInterruptionHandler;
+    tInterruptibleThreadPool* m_pExecutor = nullptr;
+    std::exception_ptr m_ExceptionPtr;
+    bool m_Started = false;
+
+    // nullptr while running, the address of the awaiting coroutine, or Done() when completed
+    std::atomic<void*> m_Continuation{ nullptr };
+    std::shared_ptr<tInterruptibleThread::tCompletionEvent> m_xCompletion = std::make_shared<tInterruptibleThread::tCompletionEvent>();
+
+    void* Done() noexcept { return this; }
+};
+
+/// Coroutine task with the tInterruptionHandler semantics: every co_await is an
+/// interruption checkpoint throwing tException. The coroutines are multiplexed
+/// over the workers of a tInterruptibleThreadPool, so a suspended task costs only
+/// its coroutine frame instead of a thread stack.
+template <typename T = void>
+class tInterruptibleCoroutine;
+
+class tInterruptibleCoroutineBase
+{
+public:
+    using tInterruptionHandlerPtr = tInterruptibleThread::tInterruptionHandlerPtr;
+
+    /// co_await Yield() moves the coroutine to the back of the executor queue
+    class tYieldAwaiter
+    {
+    public:
+        bool await_ready() const noexcept { return false; }
+
+        template <typename Promise>
+        void await_suspend(std::coroutine_handle<Promise> handle)
+        {
+            m_pPromise = &handle.promise();
+            m_pPromise->Post(handle);
+        }
+
+        void await_resume() { m_pPromise->CheckPoint(); }
+
+    private:
+        tInterruptibleCoroutinePromiseBase* m_pPromise = nullptr;
+    };
+
+    /// co_await SleepFor(t) suspends the coroutine without blocking a worker.
+    /// The tDeadlineTimer thread or the interruption resumes it, whichever comes first.
+    class tSleepAwaiter
+    {
+    public:
+        explicit tSleepAwaiter(std::chrono::steady_clock::time_point deadline) : m_Deadline(deadline) {}
+
+        bool await_ready() const noexcept { return std::chrono::steady_clock::now() >= m_Deadline; }
+
+        template <typename Promise>
+        bool await_suspend(std::coroutine_handle<Promise> handle)
+        {
+            m_pPromise = &handle.promise();
+            m_xState = std::make_shared<tState>(handle, m_pPromise);
+
+            // The awaiter lives in the coroutine frame, once registered the coroutine
+            // can be resumed at any time: only locals are used from here on
+            std::weak_ptr<tState> xWeakState = m_xState;
+            auto wake = [xWeakState]()
+            {
+                if (auto xState = xWeakState.lock())
+                {
+                    xState->Wake();
+                }
+            };
+            auto deadline = m_Deadline;
+            auto xHandler = m_pPromise->m_xInterruptionHandler;
+
+            if (xHandler && !xHandler->OnInterrupt(xWeakState, wake))
+            {
+                return false;
+            }
+            tInterruptibleThread::tDeadlineTimer::Instance().Schedule(deadline, wake);
+            return true;
+        }
+
+        void await_resume()
+        {
+            if (m_pPromise)
+            {
+                m_pPromise->CheckPoint();
+            }
+        }
+
+    private:
+        struct tState
+        {
+            tState(std::coroutine_handle<> handle, tInterruptibleCoroutinePromiseBase* pPromise)
+                : m_Handle(handle), m_pPromise(pPromise) {}
+
+            void Wake()
+            {
+                if (!m_Woken.exchange(true))
+                {
+                    m_pPromise->Post(m_Handle);
+                }
+            }
+
+            std::coroutine_handle<> m_Handle;
+            tInterruptibleCoroutinePromiseBase* m_pPromise;
+            std::atomic_bool m_Woken{ false };
+        };
+
+        std::chrono::steady_clock::time_point m_Deadline;
+        tInterruptibleCoroutinePromiseBase* m_pPromise = nullptr;
+        std::shared_ptr<tState> m_xState;
+    };
+
+    static tYieldAwaiter Yield() { return tYieldAwaiter(); }
+
+    template <typename Rep, typename Period>
+    static tSleepAwaiter SleepFor(const std::chrono::duration<Rep, Period>& t)
+    {
+        return tSleepAwaiter(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(t));
+    }
+};
+
+template <typename T>
+class tInterruptibleCoroutine : public tInterruptibleCoroutineBase
+{
+public:
+    struct promise_type;
+    using tHandle = std::coroutine_handle<promise_type>;
+
+    struct tFinalAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(tHandle handle) noexcept
+        {
+            promise_type& promise = handle.promise();
+            void* pContinuation = promise.m_Continuation.exchange(promise.Done());
+
+            // The owner can destroy the frame as soon as the event is set
+            auto xCompletion = promise.m_xCompletion;
+            xCompletion->Set();
+
+            if (pContinuation != nullptr)
+            {
+                return std::coroutine_handle<>::from_address(pContinuation);
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    struct tValuePromise : tInterruptibleCoroutinePromiseBase
+    {
+        using tInterruptibleCoroutinePromiseBase::tInterruptibleCoroutinePromiseBase;
+
+        template <typename U>
+        void return_value(U&& value) { m_Value.emplace(std::forward<U>(value)); }
+
+        T Result()
+        {
+            if (m_ExceptionPtr)
+            {
+                std::rethrow_exception(m_ExceptionPtr);
+            }
+            return std::move(*m_Value);
+        }
+
+        std::optional<T> m_Value;
+    };
+
+    struct tVoidPromise : tInterruptibleCoroutinePromiseBase
+    {
+        using tInterruptibleCoroutinePromiseBase::tInterruptibleCoroutinePromiseBase;
+
+        void return_void() {}
+
+        void Result()
+        {
+            if (m_ExceptionPtr)
+            {
+                std::rethrow_exception(m_ExceptionPtr);
             }
         }
-        bool Interrupted() { return m_Interrupt; }
-        void Interrupt() { m_Interrupt = true; }
-
-    protected:
-        std::atomic_bool m_Interrupt;
     };
-    typedef std::shared_ptr<tInterruptionHandler> tInterruptionHandlerPtr;
 
-    using Id = std::thread::id;
-
-    using NativeHandleType = std::thread::native_handle_type;
+    struct promise_type : std::conditional<std::is_void<T>::value, tVoidPromise, tValuePromise>::type
+    {
+        using tBase = typename std::conditional<std::is_void<T>::value, tVoidPromise, tValuePromise>::type;
+        using tBase::tBase;
 
+        tInterruptibleCoroutine get_return_object() { return tInterruptibleCoroutine(tHandle::from_promise(*this)); }
 
-    tInterruptibleThread() noexcept = default;
+        tFinalAwaiter final_suspend() noexcept { return {}; }
+    };
 
-    ~tInterruptibleThread()
+    /// co_await of a coroutine from another coroutine: a coroutine not started yet
+    /// runs on the executor of the awaiting one and inherits its handler
+    class tAwaiter
     {
-        if (m_xThread && m_xThread->joinable())
-        {
-            JoinImp();
-        }
-    }
+    public:
+        explicit tAwaiter(tHandle handle) : m_Handle(handle) {}
 
-    template <typename Callable, typename... Args>
-    tInterruptibleThread(bool detached, Callable&& f, tInterruptionHandlerPtr xInterrupHandler, Args&&... args)
-        : m_ExceptionPtr(nullptr)
-        , m_Mutex()
-        , m_Ready(false)
-        , m_Interruptionhandler(xInterrupHandler)
-    {        
-        auto task = [this](bool isDetached,
-                        typename std::decay<Callable>::type&& f,
-                        tInterruptionHandlerPtr xInterrupHandler,
-                        typename std::decay<Args>::type&&... args)
-        {
-            if (!isDetached)
-            {
-                std::lock_guard<std::mutex> lock(m_Mutex);
-                m_Ready = false;
-            }
-            try
-            {
-                std::bind(f, std::forward<tInterruptionHandlerPtr>(xInterrupHandler), args...)();
-            }
-            catch (...)
+        bool await_ready() const noexcept { return m_Handle.promise().m_Continuation.load() == m_Handle.promise().Done(); }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> awaiting)
+        {
+            promise_type& promise = m_Handle.promise();
+            tInterruptibleCoroutinePromiseBase& awaitingPromise = awaiting.promise();
+            if (!promise.m_Started)
             {
-                // The tInterruptibleThread instance could be already destroied in detahced mode
-                if (!isDetached)
+                promise.m_Started = true;
+                promise.m_pExecutor = awaitingPromise.m_pExecutor;
+                if (!promise.m_xInterruptionHandler)
                 {
-                    m_ExceptionPtr = std::current_exception();
+                    promise.m_xInterruptionHandler = awaitingPromise.m_xInterruptionHandler;
                 }
+                promise.m_Continuation = awaiting.address();
+                return m_Handle;
             }
 
-            if (!isDetached)
+            void* pExpected = nullptr;
+            if (promise.m_Continuation.compare_exchange_strong(pExpected, awaiting.address()))
             {
-                {
-                    std::lock_guard<std::mutex> lock(m_Mutex);
-                    m_Ready = true;
-                }
-                m_Condition.notify_one();
+                return std::noop_coroutine();
             }
-        };
+            // Already completed
+            return awaiting;
+        }
 
-        m_xThread = std::unique_ptr<std::thread>(new std::thread(
-              task,               
-              detached,
-              std::forward<Callable>(f),
-              xInterrupHandler,
-              std::forward<Args>(args)...));
+        T await_resume() { return m_Handle.promise().Result(); }
 
-        if(!m_xThread)
-        {
-            throw std::runtime_error("Cannot create the tread");
-        }
-        
-        if (detached)
+    private:
+        tHandle m_Handle;
+    };
+
+    tInterruptibleCoroutine() noexcept = default;
+
+    tInterruptibleCoroutine(tInterruptibleCoroutine&& other) noexcept : m_Handle(other.m_Handle) { other.m_Handle = nullptr; }
+
+    tInterruptibleCoroutine& operator=(tInterruptibleCoroutine&& other) noexcept
+    {
+        if (this != &other)
         {
-            m_xThread->detach();
+            Destroy();
+            m_Handle = other.m_Handle;
+            other.m_Handle = nullptr;
         }
+        return *this;
     }
 
-    bool Joinable() const noexcept { return m_xThread->joinable(); }
+    /// As tInterruptibleThread, a running coroutine is interrupted and awaited
+    ~tInterruptibleCoroutine() { Destroy(); }
 
-    void Join()
+    /// Start the coroutine on the executor, it can then be joined or co_awaited
+    void Start(tInterruptibleThreadPool& executor)
     {
-        JoinImp();
-
-        if (m_ExceptionPtr != nullptr)
+        promise_type& promise = m_Handle.promise();
+        if (promise.m_Started)
         {
-            std::rethrow_exception(m_ExceptionPtr);
+            throw std::logic_error("Coroutine already started");
         }
+        promise.m_Started = true;
+        promise.m_pExecutor = &executor;
+        executor.Execute([handle = m_Handle]() { handle.resume(); });
     }
 
-    tInterruptionHandlerPtr InterruptionHandler() { return m_Interruptionhandler; }
+    bool Ready() const noexcept { return m_Handle && m_Handle.promise().m_xCompletion->IsSet(); }
+
+    /// Wait for the completion from a thread, rethrows the exception of the coroutine
+    T Join()
+    {
+        m_Handle.promise().m_xCompletion->Wait();
+        return m_Handle.promise().Result();
+    }
 
     void Interrupt()
     {
-        if (m_Interruptionhandler)
+        if (m_Handle && m_Handle.promise().m_xInterruptionHandler)
         {
-            m_Interruptionhandler->Interrupt();
+            m_Handle.promise().m_xInterruptionHandler->Interrupt();
         }
     }
 
-    Id GetId() const noexcept { return m_xThread->get_id(); }
-
-    NativeHandleType NativeHandle() { return m_xThread->native_handle(); }
-
-    static uint32_t HardwareConcurrency() noexcept { return std::thread::hardware_concurrency(); }
+    tInterruptionHandlerPtr InterruptionHandler() { return m_Handle.promise().m_xInterruptionHandler; }
 
-    static void Wait(std::chrono::duration<double, std::milli> t) { std::this_thread::sleep_for(t); }
+    tAwaiter operator co_await() && noexcept { return tAwaiter(m_Handle); }
+    tAwaiter operator co_await() & noexcept { return tAwaiter(m_Handle); }
 
 private:
-    void JoinImp()
+    explicit tInterruptibleCoroutine(tHandle handle) : m_Handle(handle) {}
+
+    void Destroy()
     {
-        // m_Thread.join() could throw No such proccess exception
-        // also if the thread is joinable so we detach the tread
-        // and we wait for completion
-        m_xThread->detach();
-        std::unique_lock<std::mutex> lock(m_Mutex);
-        m_Condition.wait(lock, [&] { return (bool)m_Ready; });
+        if (!m_Handle)
+        {
+            return;
+        }
+        promise_type& promise = m_Handle.promise();
+        if (promise.m_Started && !promise.m_xCompletion->IsSet())
+        {
+            Interrupt();
+            promise.m_xCompletion->Wait();
+        }
+        m_Handle.destroy();
+        m_Handle = nullptr;
     }
-    std::exception_ptr m_ExceptionPtr;
-    tInterruptionHandlerPtr m_Interruptionhandler;
-    std::condition_variable m_Condition;
-    std::mutex m_Mutex;
-    bool m_Ready;
-    std::unique_ptr<std::thread> m_xThread;
+
+    tHandle m_Handle;
 };
 
+#endif
+#endif
+
 /******************************************************************/
 /*************************** TEST *********************************/
 
@@ -170,7 +2786,7 @@ void staticFunction(tInterruptibleThread::tInterruptionHandlerPtr handler, int i
     for(int j = 0 ; j < maxStep; j++)
     {
         handler->InterruptionCheckPoint();
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        handler->SleepFor(std::chrono::milliseconds(100));
         std::cout << "======================= task " << i << " step "<< j <<"/" << maxStep<< std::endl;
     }
         
@@ -188,6 +2804,472 @@ public:
     }
 };
 
+int poolFunction(tInterruptibleThread::tInterruptionHandlerPtr handler, int i)
+{
+    int sum = 0;
+    for (int j = 0; j < 1000; j++)
+    {
+        handler->InterruptionCheckPoint();
+        sum += i * j;
+    }
+    return sum;
+}
+
+void poolTest()
+{
+    tInterruptibleThread::tThreadOptions options;
+    options.m_Name = "pool";
+    tInterruptibleThreadPool pool(options);
+    std::cout << "======================== pool with " << pool.Size() << " workers" << std::endl;
+
+    std::vector<tInterruptibleThreadPool::tTask> tasks;
+    for (int i = 0; i < 16; i++)
+    {
+        tasks.push_back(pool.Submit(poolFunction, std::make_shared<tInterruptibleThread::tInterruptionHandler>(), i));
+    }
+
+    tInterruptibleThread::tInterruptionHandlerPtr handler = std::make_shared<tInterruptibleThread::tInterruptionHandler>();
+    auto longTask = pool.Submit(staticFunction, handler, 3);
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    longTask.Interrupt();
+
+    for (auto& task : tasks)
+    {
+        task.Join();
+    }
+    std::cout << "======================== pool tasks completed" << std::endl;
+
+    try
+    {
+        longTask.Join(); // Rethrow the exception causing the task interruption
+    }
+    catch (std::exception& e)
+    {
+        std::cout << e.what() << std::endl;
+    }
+
+    // On a single worker a task joining its sub-task runs it while waiting, and a
+    // throwing Execute() task does not stop the worker
+    tInterruptibleThreadPool single(1);
+    single.Execute([]() { throw std::runtime_error("dropped"); });
+    auto parent = single.Submit([&single](tInterruptibleThread::tInterruptionHandlerPtr, int i)
+    {
+        auto child = single.Submit([](tInterruptibleThread::tInterruptionHandlerPtr, int j) { return j; }, nullptr, i);
+        child.Join();
+    }, nullptr, 1);
+    parent.Join();
+    std::cout << "======================== nested join on one worker completed, " << single.UnhandledExceptions() << " unhandled exception" << std::endl;
+}
+
+void waitTest()
+{
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool ready = false;
+    std::promise<int> promise;
+    std::future<int> future = promise.get_future();
+
+    auto waitCondition = [&](tInterruptibleThread::tInterruptionHandlerPtr handler)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        handler->Wait(condition, lock, [&] { return ready; });
+    };
+    auto waitFuture = [&](tInterruptibleThread::tInterruptionHandlerPtr handler) { handler->Wait(std::move(future)); };
+
+    tInterruptibleThread conditionThread(false, waitCondition, std::make_shared<tInterruptibleThread::tInterruptionHandler>());
+    tInterruptibleThread futureThread(false, waitFuture, std::make_shared<tInterruptibleThread::tInterruptionHandler>());
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    auto start = std::chrono::steady_clock::now();
+    conditionThread.Interrupt();
+    futureThread.Interrupt();
+    for (tInterruptibleThread* pThread : { &conditionThread, &futureThread })
+    {
+        try
+        {
+            pThread->Join();
+        }
+        catch (std::exception& e)
+        {
+            auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            std::cout << "======================== wait " << e.what() << " after " << latency.count() << " us" << std::endl;
+        }
+    }
+
+    // A future completed by another thread wakes up the wait through its watcher
+    std::promise<int> valuePromise;
+    std::thread setter([&] 
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        valuePromise.set_value(42);
+    });
+    int value = std::make_shared<tInterruptibleThread::tInterruptionHandler>()->Wait(valuePromise.get_future()).get();
+    setter.join();
+    std::cout << "======================== future wait returned " << value << std::endl;
+
+    // Two waits on different conditions sharing the handler
+    std::condition_variable otherCondition;
+    auto waitOtherCondition = [&](tInterruptibleThread::tInterruptionHandlerPtr handler)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        handler->Wait(otherCondition, lock, [&] { return ready; });
+    };
+    auto xShared = std::make_shared<tInterruptibleThread::tInterruptionHandler>();
+    tInterruptibleThread firstThread(false, waitCondition, xShared);
+    tInterruptibleThread secondThread(false, waitOtherCondition, xShared);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    xShared->Interrupt();
+    int interrupted = 0;
+    for (tInterruptibleThread* pThread : { &firstThread, &secondThread })
+    {
+        try
+        {
+            pThread->Join();
+        }
+        catch (tInterruptibleThread::tInterruptionHandler::tException&)
+        {
+            interrupted++;
+        }
+    }
+    std::cout << "======================== shared handler interrupted " << interrupted << " waits" << std::endl;
+}
+
+/// Forces the value to be computed and the memory to be reloaded on every
+/// iteration, so the benchmarked loops cannot be folded or hoisted
+template <typename T>
+inline void DoNotOptimize(const T& value)
+{
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    volatile T sink = value;
+    (void)sink;
+#endif
+}
+
+template <typename CheckPoint>
+void checkPointLoop(const char* name, uint64_t iterations, CheckPoint checkPoint)
+{
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t j = 0; j < iterations; j++)
+    {
+        checkPoint(j);
+        sum += j ^ (sum >> 3);
+        DoNotOptimize(sum);
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start);
+    std::cout << "======================== " << name << ": " << elapsed.count() / iterations << " ns/iteration" << std::endl;
+}
+
+void checkPointBenchmark()
+{
+    const uint64_t iterations = 50000000;
+    tInterruptibleThread::tInterruptionHandlerPtr handler = std::make_shared<tInterruptibleThread::tInterruptionHandler>();
+    tInterruptibleThread::tAmortizedCheckPoint amortized(handler);
+
+    checkPointLoop("no checkpoint", iterations, [](uint64_t) {});
+    checkPointLoop("InterruptionCheckPoint", iterations, [&](uint64_t) { handler->InterruptionCheckPoint(); });
+    checkPointLoop("FastInterruptionCheckPoint", iterations, [&](uint64_t) { handler->FastInterruptionCheckPoint(); });
+    checkPointLoop("tAmortizedCheckPoint", iterations, [&](uint64_t j) { amortized(j); });
+}
+
+void cancellationTreeTest()
+{
+    // One request fanned out into several sub-tasks sharing the request timeout
+    tInterruptibleThread::tInterruptionHandlerPtr request = std::make_shared<tInterruptibleThread::tInterruptionHandler>();
+    auto subTask = [](tInterruptibleThread::tInterruptionHandlerPtr handler, int i)
+    {
+        handler->SleepFor(std::chrono::seconds(60));
+        std::cout << "======================== sub-task " << i << " ended." << std::endl;
+    };
+
+    std::vector<std::unique_ptr<tInterruptibleThread>> subTasks;
+    for (int i = 0; i < 8; i++)
+    {
+        subTasks.emplace_back(new tInterruptibleThread(false, subTask, request->CreateChild(), i));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    request->SetTimeout(std::chrono::milliseconds(300));
+
+    int interrupted = 0;
+    for (auto& xSubTask : subTasks)
+    {
+        try
+        {
+            xSubTask->Join();
+        }
+        catch (tInterruptibleThread::tInterruptionHandler::tException&)
+        {
+            interrupted++;
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << "======================== request timeout interrupted " << interrupted << " sub-tasks after " << elapsed.count() << " ms" << std::endl;
+}
+
+void joinTest()
+{
+    auto shortTask = [](tInterruptibleThread::tInterruptionHandlerPtr handler, int i)
+    {
+        handler->SleepFor(std::chrono::milliseconds(50 * i));
+    };
+
+    std::vector<std::unique_ptr<tInterruptibleThread>> threads;
+    std::vector<tInterruptibleThread*> pending;
+    for (int i = 1; i <= 4; i++)
+    {
+        threads.emplace_back(new tInterruptibleThread(false, shortTask, std::make_shared<tInterruptibleThread::tInterruptionHandler>(), i));
+        pending.push_back(threads.back().get());
+    }
+
+    std::cout << "======================== TryJoin before completion: " << pending.back()->TryJoin() << std::endl;
+    std::cout << "======================== JoinFor(10 ms): " << pending.back()->JoinFor(std::chrono::milliseconds(10)) << std::endl;
+
+    // Reap the threads in completion order
+    while (!pending.empty())
+    {
+        size_t index = tInterruptibleThread::WhenAny(pending);
+        pending[index]->Join();
+        pending.erase(pending.begin() + index);
+        std::cout << "======================== reaped a thread, " << pending.size() << " still running" << std::endl;
+    }
+
+    // Nothing to wait for in default constructed threads
+    tInterruptibleThread idle;
+    try
+    {
+        tInterruptibleThread::WhenAny({ &idle });
+    }
+    catch (std::invalid_argument& e)
+    {
+        std::cout << "======================== " << e.what() << std::endl;
+    }
+}
+
+#if defined(INTERRUPTIBLE_COROUTINE_SUPPORTED)
+tInterruptibleCoroutine<int> coroutineStep(tInterruptibleThread::tInterruptionHandlerPtr, int i)
+{
+    co_await tInterruptibleCoroutine<>::Yield();
+    co_return i;
+}
+
+tInterruptibleCoroutine<int> coroutineFunction(tInterruptibleThread::tInterruptionHandlerPtr handler, int i)
+{
+    co_await tInterruptibleCoroutine<>::SleepFor(std::chrono::seconds(1));
+    co_return co_await coroutineStep(handler, i);
+}
+
+void coroutineTest()
+{
+    const int count = 100000;
+    tInterruptibleThreadPool executor;
+    tInterruptibleThread::tInterruptionHandlerPtr cancelled = std::make_shared<tInterruptibleThread::tInterruptionHandler>();
+
+    std::vector<tInterruptibleCoroutine<int>> coroutines;
+    coroutines.reserve(count);
+    for (int i = 0; i < count; i++)
+    {
+        // Every other coroutine belongs to the cancelled group
+        auto handler = (i % 2) ? cancelled->CreateChild() : std::make_shared<tInterruptibleThread::tInterruptionHandler>();
+        coroutines.push_back(coroutineFunction(handler, i));
+        coroutines.back().Start(executor);
+    }
+    cancelled->Interrupt();
+
+    long long sum = 0;
+    int interrupted = 0;
+    for (auto& coroutine : coroutines)
+    {
+        try
+        {
+            sum += coroutine.Join();
+        }
+        catch (tInterruptibleThread::tInterruptionHandler::tException&)
+        {
+            interrupted++;
+        }
+    }
+    std::cout << "======================== " << count << " coroutines, " << interrupted << " interrupted, sum " << sum << std::endl;
+}
+#endif
+
+#if defined(tInterruptibleThreadInstrumentation)
+void instrumentationTest()
+{
+    std::ofstream("tasks.json") << tTaskInstrumentation::ToJson(tTaskInstrumentation::Snapshot());
+    std::ofstream("tasks_trace.json") << tTaskInstrumentation::ToChromeTrace(tTaskInstrumentation::Snapshot());
+    std::cout << "======================== " << tTaskInstrumentation::Snapshot().size() << " task records written to tasks.json and tasks_trace.json" << std::endl;
+}
+#endif
+
+/// Bounded mutex+deque queue used as baseline by channelBenchmark
+template <typename T>
+class tMutexQueue
+{
+public:
+    explicit tMutexQueue(size_t capacity) : m_Capacity(capacity) {}
+
+    void Push(T value)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_NotFull.wait(lock, [&] { return m_Queue.size() < m_Capacity; });
+        m_Queue.push_back(std::move(value));
+        m_NotEmpty.notify_one();
+    }
+
+    T Pop()
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_NotEmpty.wait(lock, [&] { return !m_Queue.empty(); });
+        T value = std::move(m_Queue.front());
+        m_Queue.pop_front();
+        m_NotFull.notify_one();
+        return value;
+    }
+
+private:
+    size_t m_Capacity;
+    std::deque<T> m_Queue;
+    std::condition_variable m_NotFull;
+    std::condition_variable m_NotEmpty;
+    std::mutex m_Mutex;
+};
+
+template <typename Producer, typename Consumer>
+void channelRun(const char* name, int threads, int itemsPerThread, Producer producer, Consumer consumer)
+{
+    std::vector<std::thread> workers;
+    std::atomic<long long> sum(0);
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t] { producer(t, itemsPerThread); });
+        workers.emplace_back([&] { sum += consumer(itemsPerThread); });
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    std::cout << "======================== " << name << ": " << (threads * (double)itemsPerThread / elapsed.count() / 1e6)
+              << " M items/s (sum " << sum << ")" << std::endl;
+}
+
+void channelBenchmark()
+{
+    const int threads = 2;
+    const int items = 1000000;
+    const size_t capacity = 1024;
+    const size_t batch = 64;
+    tInterruptibleThread::tInterruptionHandlerPtr handler = std::make_shared<tInterruptibleThread::tInterruptionHandler>();
+
+    tMutexQueue<int> mutexQueue(capacity);
+    channelRun("mutex+deque", threads, items,
+        [&](int, int n) { for (int i = 0; i < n; i++) mutexQueue.Push(i); },
+        [&](int n) { long long sum = 0; for (int i = 0; i < n; i++) sum += mutexQueue.Pop(); return sum; });
+
+    tInterruptibleChannel<int> channel(capacity);
+    channelRun("tInterruptibleChannel", threads, items,
+        [&](int, int n) { for (int i = 0; i < n; i++) channel.Push(i, handler); },
+        [&](int n) { long long sum = 0; for (int i = 0; i < n; i++) sum += channel.Pop(handler); return sum; });
+
+    channelRun("tInterruptibleChannel batch", threads, items,
+        [&](int, int n)
+        {
+            std::vector<int> values(batch);
+            for (int i = 0; i < n; i += (int)batch)
+            {
+                size_t count = std::min(batch, (size_t)(n - i));
+                for (size_t j = 0; j < count; j++)
+                {
+                    values[j] = i + (int)j;
+                }
+                channel.PushBatch(values.begin(), values.begin() + count, handler);
+            }
+        },
+        [&](int n)
+        {
+            long long sum = 0;
+            std::vector<int> values(batch);
+            for (int received = 0; received < n;)
+            {
+                size_t count = channel.PopBatch(values.begin(), std::min(batch, (size_t)(n - received)), handler);
+                for (size_t j = 0; j < count; j++)
+                {
+                    sum += values[j];
+                }
+                received += (int)count;
+            }
+            return sum;
+        });
+
+    // A consumer blocked on an empty channel is woken up by the interruption
+    tInterruptibleChannel<int> empty(16);
+    tInterruptibleThread consumer(false, [&](tInterruptibleThread::tInterruptionHandlerPtr h) { empty.Pop(h); },
+                                  std::make_shared<tInterruptibleThread::tInterruptionHandler>());
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    consumer.Interrupt();
+    try
+    {
+        consumer.Join();
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "======================== blocked Pop: " << e.what() << std::endl;
+    }
+}
+
+void schedulerTest()
+{
+    const int count = 200000;
+    tInterruptibleThreadPool executor;
+    tInterruptibleScheduler scheduler(executor);
+    std::atomic<int> fired(0);
+    auto timeout = [&](tInterruptibleThread::tInterruptionHandlerPtr) { fired++; };
+
+    std::vector<tInterruptibleScheduler::tScheduledTask> timeouts;
+    timeouts.reserve(count);
+    for (int i = 0; i < count; i++)
+    {
+        timeouts.push_back(scheduler.ScheduleAfter(std::chrono::milliseconds(300 + i % 200), timeout,
+                                                   std::make_shared<tInterruptibleThread::tInterruptionHandler>()));
+    }
+    // Cancel half of the timeouts, the others expire
+    for (int i = 0; i < count; i += 2)
+    {
+        timeouts[i].Cancel();
+    }
+
+    std::atomic<int> ticks(0);
+    auto periodic = scheduler.ScheduleEvery(std::chrono::milliseconds(0), std::chrono::milliseconds(100),
+                                            [&](tInterruptibleThread::tInterruptionHandlerPtr) { ticks++; },
+                                            std::make_shared<tInterruptibleThread::tInterruptionHandler>());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(650));
+    periodic.Cancel();
+    std::cout << "======================== " << fired << " of " << count << " timeouts fired, periodic task run " << ticks
+              << " times, " << scheduler.Pending() << " pending" << std::endl;
+
+    // A periodic task without handler cancelled while it is running is not re-armed
+    std::atomic<int> runs(0);
+    auto slow = scheduler.ScheduleEvery(std::chrono::milliseconds(0), std::chrono::milliseconds(10),
+                                        [&](tInterruptibleThread::tInterruptionHandlerPtr)
+                                        {
+                                            runs++;
+                                            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                                        },
+                                        nullptr);
+    while (runs == 0)
+    {
+        std::this_thread::yield();
+    }
+    slow.Cancel();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    std::cout << "======================== periodic task cancelled while running, run " << runs << " times" << std::endl;
+}
+
 int main()
 { 
     TestClass testClass;
@@ -215,5 +3297,19 @@ int main()
         std::cout << e.what() << std::endl;
     }
 
+    poolTest();
+    waitTest();
+    checkPointBenchmark();
+    cancellationTreeTest();
+    joinTest();
+    channelBenchmark();
+    schedulerTest();
+#if defined(INTERRUPTIBLE_COROUTINE_SUPPORTED)
+    coroutineTest();
+#endif
+#if defined(tInterruptibleThreadInstrumentation)
+    instrumentationTest();
+#endif
+
     return 0;
 }
@@ -6,6 +6,95 @@
 #include <iostream>
 #include <streambuf>
 #include <cstring>
+#include <type_traits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#include <nmmintrin.h>
+#define MEMORY_BINARY_STREAM_SSSE3
+#define MEMORY_BINARY_STREAM_CRC32C_SSE42
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <system_error>
+#endif
+#if defined(__has_include)
+#if __has_include(<span>)
+#include <span>
+#endif
+#endif
+
+/// View of bytes stored in a buffer, valid until the next write reallocating the buffer
+#if defined(__cpp_lib_span)
+using MemoryView = std::span<const uint8_t>;
+#else
+class MemoryView
+{
+public:
+    MemoryView() : m_Data(nullptr), m_Size(0) {}
+    MemoryView(const uint8_t* inData, size_t inSize) : m_Data(inData), m_Size(inSize) {}
+
+    const uint8_t* data() const { return m_Data; }
+    size_t size() const { return m_Size; }
+    bool empty() const { return m_Size == 0; }
+    const uint8_t* begin() const { return m_Data; }
+    const uint8_t* end() const { return m_Data + m_Size; }
+    const uint8_t& operator[](size_t i) const { return m_Data[i]; }
+
+private:
+    const uint8_t* m_Data;
+    size_t m_Size;
+};
+#endif
+
+/// How MemoryBuffer computes its new capacity when the written bytes do not fit
+class GrowthPolicy
+{
+public:
+    enum Kind
+    {
+        Geometric,// Double the capacity, amortized constant time per byte
+        Linear,// Grow by a fixed step
+        Fixed// Never grow, throw std::length_error
+    };
+
+    static GrowthPolicy geometric(size_t inInitial = 1024) { return GrowthPolicy(Geometric, inInitial); }
+    static GrowthPolicy linear(size_t inStep) { return GrowthPolicy(Linear, inStep); }
+    static GrowthPolicy fixed(size_t inCapacity) { return GrowthPolicy(Fixed, inCapacity); }
+
+    Kind kind() const { return m_Kind; }
+    size_t initial_capacity() const { return m_Size; }
+
+    size_t next_capacity(size_t current_capacity, size_t required_size) const
+    {
+        switch (m_Kind)
+        {
+        case Geometric:
+            return std::max(required_size, std::max(current_capacity * 2, m_Size));
+        case Linear:
+            return ((required_size / m_Size) + 1) * m_Size;
+        default:
+            throw std::length_error("MemoryBuffer: fixed capacity exceeded");
+        }
+    }
+
+private:
+    GrowthPolicy(Kind inKind, size_t inSize) : m_Kind(inKind), m_Size(std::max<size_t>(inSize, 1)) {}
+
+    Kind m_Kind;
+    size_t m_Size;
+};
 
 class MemoryBuffer : public std::streambuf
 {
@@ -13,38 +102,153 @@ private:
     std::vector<uint8_t> m_DefaultBuffer;
     std::vector<uint8_t>& m_Buffer;
     static const size_t RESERVE_SIZE = 1024;
-    size_t m_Resize;
+    GrowthPolicy m_Growth;
+
+    char* base() const { return (char*)m_Buffer.data(); }
+
+    // Bytes stored through the put area (e.g. by sputc) are beyond m_Buffer.size(),
+    // they have to be added to the vector before it is resized or reallocated
+    void commit() const
+    {
+        auto* lastPos = base() + m_Buffer.size();
+        if (pptr() > lastPos)
+        {
+            m_Buffer.insert(m_Buffer.end(), lastPos, pptr());
+        }
+    }
+
+    // pbump takes an int, the buffer can be larger than 2 GB
+    void advance_put(size_t n)
+    {
+        while (n > 0)
+        {
+            int step = (int)std::min<size_t>(n, INT_MAX);
+            pbump(step);
+            n -= step;
+        }
+    }
+
+    // Restore the put and get areas after a reallocation of the vector
+    void reset_areas(size_t putOffset, size_t getOffset)
+    {
+        setp(base(), base() + m_Buffer.capacity());
+        advance_put(putOffset);
+        setg(base(), base() + getOffset, base() + m_Buffer.size());
+    }
 
     void expand_buffer(size_t additional_size)
     {
-        size_t current_size = m_Buffer.size();
-        size_t required_size = current_size + additional_size;
-        size_t new_capacity = ((required_size / m_Resize) + 1) * m_Resize;
-        m_Buffer.reserve(new_capacity);
-        setp((char*)m_Buffer.data(), (char*)m_Buffer.data() + m_Buffer.capacity());
-        pbump(m_Buffer.size());
+        commit();
+        size_t putOffset = pptr() - pbase();
+        size_t getOffset = gptr() - eback();
+        size_t required_size = std::max(m_Buffer.size(), putOffset + additional_size);
+        m_Buffer.reserve(m_Growth.next_capacity(m_Buffer.capacity(), required_size));
+        reset_areas(putOffset, getOffset);
     }
 
 public:
     void reserve(size_t newCapacity)
     {
+        commit();
+        size_t putOffset = pptr() - pbase();
+        size_t getOffset = gptr() - eback();
         m_Buffer.reserve(newCapacity);
-        setp((char*)m_Buffer.data(), (char*)m_Buffer.data() + m_Buffer.capacity());
-        pbump(m_Buffer.size());
+        reset_areas(putOffset, getOffset);
+    }
+
+    MemoryBuffer(GrowthPolicy inGrowth = GrowthPolicy::geometric(RESERVE_SIZE)) : m_Buffer(m_DefaultBuffer), m_Growth(inGrowth) 
+    {
+        m_Buffer.reserve(m_Growth.initial_capacity()); 
+        reset_areas(0, 0);
+    }
+
+    /// Grow linearly by inResize bytes
+    MemoryBuffer(size_t inResize) : MemoryBuffer(GrowthPolicy::linear(inResize)) {}
+
+    /// The content of inBuffer can be read, the writes are appended to it
+    MemoryBuffer(std::vector<uint8_t>& inBuffer, GrowthPolicy inGrowth = GrowthPolicy::geometric(RESERVE_SIZE)) : m_Buffer(inBuffer), m_Growth(inGrowth) 
+    {
+        if (m_Growth.kind() == GrowthPolicy::Fixed)
+        {
+            m_Buffer.reserve(m_Growth.initial_capacity());
+        }
+        reset_areas(m_Buffer.size(), 0);
+    }
+
+    MemoryBuffer(std::vector<uint8_t>& inBuffer, size_t inResize) : MemoryBuffer(inBuffer, GrowthPolicy::linear(inResize)) {}
+
+    const std::vector<uint8_t>& data() const 
+    { 
+        commit();
+        return m_Buffer; 
+    }
+
+    /// Direct writes, bypassing the sentry and the virtual calls of std::ostream::write
+    template <typename T>
+    void put(const T& value)
+    {
+        put_bytes(&value, sizeof(T));
+    }
+
+    void put_bytes(const void* pValue, size_t n)
+    {
+        memcpy(reserve_and_get(n), pValue, n);
+    }
+
+    /// Return a pointer to n bytes at the put position and skip them, the caller fills them.
+    /// The pointer is valid until the next write
+    uint8_t* reserve_and_get(size_t n)
+    {
+        if ((size_t)(epptr() - pptr()) < n)
+        {
+            expand_buffer(n);
+        }
+        uint8_t* result = (uint8_t*)pptr();
+        advance_put(n);
+        return result;
+    }
+
+    size_t capacity() const { return m_Buffer.capacity(); }
+
+    /// Remove the content, the capacity is kept
+    void clear()
+    {
+        m_Buffer.clear();
+        reset_areas(0, 0);
     }
 
-    MemoryBuffer(size_t inResize = RESERVE_SIZE) : m_Buffer(m_DefaultBuffer), m_Resize(inResize) 
+    /// Move the content out without copying, the buffer is left empty without capacity
+    std::vector<uint8_t> release()
     {
-        m_Buffer.reserve(m_Resize); 
-        setp((char*)m_Buffer.data(), (char*)m_Buffer.data() + m_Buffer.capacity());
+        commit();
+        std::vector<uint8_t> result(std::move(m_Buffer));
+        m_Buffer.clear();// A moved-from vector is valid but unspecified
+        m_Buffer.shrink_to_fit();
+        reset_areas(0, 0);
+        return result;
     }
 
-    MemoryBuffer(std::vector<uint8_t>& inBuffer, size_t inResize = RESERVE_SIZE) : m_Buffer(inBuffer), m_Resize(inResize) 
+    /// Return a view of all the bytes available to read, without skipping them
+    MemoryView peek_view()
     {
-        setp((char*)m_Buffer.data(), (char*)m_Buffer.data() + m_Buffer.capacity());
+        commit();
+        size_t getOffset = gptr() - eback();
+        return MemoryView(m_Buffer.data() + getOffset, m_Buffer.size() - getOffset);
     }
 
-    const std::vector<uint8_t>& data() const { return m_Buffer; }
+    /// Return a view of the next n bytes of the get area and skip them,
+    /// an empty view if less than n bytes are available
+    MemoryView read_view(size_t n)
+    {
+        commit();
+        size_t getOffset = gptr() - eback();
+        if (m_Buffer.size() - getOffset < n)
+        {
+            return MemoryView();
+        }
+        setg(base(), base() + getOffset + n, base() + m_Buffer.size());
+        return MemoryView(m_Buffer.data() + getOffset, n);
+    }
 
 protected:
     virtual int_type overflow(int_type ch) override
@@ -65,10 +269,13 @@ protected:
         {
             expand_buffer(n);
         }
+        commit();
 
-        m_Buffer.resize(m_Buffer.size() + n);// Keep the number of element correct, no re-allocation occurs
-        memcpy(pptr(), s, n);// Copy the values
-        pbump(n);
+        // Overwrite the bytes after a seekp, append the others without value-initializing them first
+        size_t overlap = std::min<size_t>(n, base() + m_Buffer.size() - pptr());
+        memcpy(pptr(), s, overlap);
+        m_Buffer.insert(m_Buffer.end(), s + overlap, s + n);// No re-allocation occurs
+        advance_put(n);
 
         return n;
     }
@@ -78,13 +285,68 @@ protected:
         // Values are already stored in the buffer, using resize 
         // to keep the number of element correct will erase them
         // For this reason we have to insert them again
-        auto* lastPos = (char*)m_Buffer.data() + m_Buffer.size();
-        m_Buffer.insert(m_Buffer.end(), lastPos, pptr());
+        commit();
         return 0;
     }
 
+    virtual int_type underflow() override
+    {
+        // Make the bytes written after the last read available
+        commit();
+        setg(base(), gptr(), base() + m_Buffer.size());
+        if (gptr() < egptr())
+        {
+            return traits_type::to_int_type(*gptr());
+        }
+        return traits_type::eof();
+    }
+
+    virtual std::streamsize xsgetn(char* s, std::streamsize n) override
+    {
+        commit();
+        size_t getOffset = gptr() - eback();
+        size_t available = m_Buffer.size() - getOffset;
+        size_t count = std::min((size_t)n, available);
+        memcpy(s, base() + getOffset, count);
+        setg(base(), base() + getOffset + count, base() + m_Buffer.size());
+        return count;
+    }
+
+    virtual std::streamsize showmanyc() override
+    {
+        commit();
+        std::streamsize available = base() + m_Buffer.size() - gptr();
+        return available > 0 ? available : -1;
+    }
+
     virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
     {
+        commit();
+        pos_type result = pos_type(off_type(-1));
+        if (which & std::ios_base::in)
+        {
+            char* new_ptr = nullptr;
+            switch (dir)
+            {
+            case std::ios_base::beg:
+                new_ptr = base() + off;
+                break;
+            case std::ios_base::cur:
+                new_ptr = gptr() + off;
+                break;
+            case std::ios_base::end:
+                new_ptr = base() + m_Buffer.size() + off;
+                break;
+            default:
+                break;
+            }
+            if (new_ptr < base() || new_ptr > base() + m_Buffer.size())
+            {
+                return pos_type(off_type(-1));
+            }
+            setg(base(), new_ptr, base() + m_Buffer.size());
+            result = new_ptr - base();
+        }
         if (which & std::ios_base::out)
         {
             char* new_ptr = nullptr;
@@ -103,26 +365,46 @@ protected:
             if (new_ptr >= (char*)m_Buffer.data() && new_ptr <= (char*)m_Buffer.data() + m_Buffer.size())
             {
                 setp((char*)m_Buffer.data(), (char*)m_Buffer.data() + m_Buffer.capacity());
-                pbump(new_ptr - (char*)m_Buffer.data());
+                advance_put(new_ptr - (char*)m_Buffer.data());
                 return new_ptr - (char*)m_Buffer.data();
             }
+            return pos_type(off_type(-1));
         }
-        return pos_type(off_type(-1));
+        return result;
     }
 
     virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which) override { return seekoff(pos, std::ios_base::beg, which); }
 };
 
-class MemoryBinaryStream : public std::iostream
+/// Base-from-member: the buffer is a base listed before the stream, so it is constructed
+/// before its address is passed to the stream constructor
+template <typename Buffer>
+struct StreamBufferMember
 {
-private:
-    MemoryBuffer m_Buffer;
+    template <typename... Args>
+    explicit StreamBufferMember(Args&&... args) : m_Buffer(std::forward<Args>(args)...) {}
+
+    Buffer m_Buffer;
+};
 
+class MemoryBinaryStream : private StreamBufferMember<MemoryBuffer>, public std::iostream
+{
 public:
     MemoryBinaryStream() : std::iostream(&m_Buffer) {}
-    MemoryBinaryStream(size_t inResize) : m_Buffer(inResize), std::iostream(&m_Buffer) {}
-    MemoryBinaryStream(std::vector<uint8_t>& inBuffer) : m_Buffer(inBuffer), std::iostream(&m_Buffer) {}
-    MemoryBinaryStream(std::vector<uint8_t>& inBuffer, size_t inResize) : m_Buffer(inBuffer, inResize), std::iostream(&m_Buffer) {}
+    MemoryBinaryStream(size_t inResize) : StreamBufferMember<MemoryBuffer>(inResize), std::iostream(&m_Buffer) {}
+    MemoryBinaryStream(std::vector<uint8_t>& inBuffer) : StreamBufferMember<MemoryBuffer>(inBuffer), std::iostream(&m_Buffer) {}
+    MemoryBinaryStream(std::vector<uint8_t>& inBuffer, size_t inResize) : StreamBufferMember<MemoryBuffer>(inBuffer, inResize), std::iostream(&m_Buffer) {}
+
+    /// With a fixed capacity policy the stream throws std::length_error when it is full
+    MemoryBinaryStream(GrowthPolicy inGrowth) : StreamBufferMember<MemoryBuffer>(inGrowth), std::iostream(&m_Buffer) 
+    {
+        throw_when_fixed(inGrowth);
+    }
+
+    MemoryBinaryStream(std::vector<uint8_t>& inBuffer, GrowthPolicy inGrowth) : StreamBufferMember<MemoryBuffer>(inBuffer, inGrowth), std::iostream(&m_Buffer) 
+    {
+        throw_when_fixed(inGrowth);
+    }
 
     template <typename T>
     MemoryBinaryStream& operator<<(T value)
@@ -137,24 +419,2770 @@ public:
         return *this;
     }
 
+    using std::ostream::put;
+
+    /// Direct writes to the buffer without the checks of std::ostream::write,
+    /// they ignore the state of the stream
+    template <typename T>
+    MemoryBinaryStream& put(const T& value)
+    {
+        m_Buffer.put(value);
+        return *this;
+    }
+
+    MemoryBinaryStream& put_bytes(const void* pValue, size_t n)
+    {
+        m_Buffer.put_bytes(pValue, n);
+        return *this;
+    }
+
+    /// Return a pointer to n bytes to fill, one capacity check for a batch of writes
+    uint8_t* reserve_and_get(size_t n) { return m_Buffer.reserve_and_get(n); }
+
+    /// Read a value written by operator<<
+    template <typename T, typename = typename std::enable_if<std::is_trivially_copyable<T>::value>::type>
+    MemoryBinaryStream& operator>>(T& value)
+    {
+        read((char*)&value, sizeof(T));
+        return *this;
+    }
+
+    /// Zero-copy read of the next n bytes, sets failbit if less than n bytes are available
+    MemoryView read_view(size_t n)
+    {
+        MemoryView view = m_Buffer.read_view(n);
+        if (view.size() != n)
+        {
+            setstate(std::ios_base::failbit | std::ios_base::eofbit);
+        }
+        return view;
+    }
+
+    /// View of all the bytes available to read, the read position is unchanged
+    MemoryView peek_view() { return m_Buffer.peek_view(); }
+
+    size_t capacity() const { return m_Buffer.capacity(); }
+
+    /// Remove the content and clear the state flags, the capacity is kept for the next writes
+    void reset()
+    {
+        m_Buffer.clear();
+        clear();
+    }
+
+    /// Move the written bytes out without copying, the stream is left empty
+    std::vector<uint8_t> release()
+    {
+        clear();
+        return m_Buffer.release();
+    }
+
     void reserve(size_t wide) 
     {
         m_Buffer.reserve(wide);
     }
 
     const std::vector<uint8_t>& data() const { return m_Buffer.data(); }
+
+private:
+    // The stream catches the exceptions of the buffer and sets badbit, 
+    // it rethrows them only when badbit is in the exception mask
+    void throw_when_fixed(const GrowthPolicy& inGrowth)
+    {
+        if (inGrowth.kind() == GrowthPolicy::Fixed)
+        {
+            exceptions(std::ios_base::badbit);
+        }
+    }
 };
-/// End
 
-int main()
+/// Thread-local pool of MemoryBinaryStream keeping their capacity between uses.
+/// The streams are stored in buckets of capacity [2^n, 2^(n+1)), the pool drops
+/// the streams returned once it retains more than max_retained() bytes
+class MemoryStreamPool
 {
-   MemoryBinaryStream memoryStream;
-   memoryStream << "Hello World\n"; 
-   memoryStream << 123u << 125u << (char)123 << (char)125<<"\n"; 
-   auto data = memoryStream.data();
-   for(const auto& d: data)
-   {
-       std::cout << d << " -> "<< (unsigned int)d <<std::endl ;
+public:
+    /// Stream leased from the pool, returned to its pool when destroyed on the thread owning the pool.
+    /// The stream is freed instead when the lease is destroyed on another thread or after the pool,
+    /// for instance by a thread_local destroyed after the one of local()
+    class Lease
+    {
+    public:
+        Lease() {}
+        Lease(Lease&& other) noexcept
+            : m_xStream(std::move(other.m_xStream)), m_xOwner(std::move(other.m_xOwner)), m_OwnerThread(other.m_OwnerThread) {}
+        Lease& operator=(Lease&& other) noexcept
+        {
+            give_back();
+            m_xStream = std::move(other.m_xStream);
+            m_xOwner = std::move(other.m_xOwner);
+            m_OwnerThread = other.m_OwnerThread;
+            return *this;
+        }
+        ~Lease() { give_back(); }
+
+        MemoryBinaryStream& operator*() const { return *m_xStream; }
+        MemoryBinaryStream* operator->() const { return m_xStream.get(); }
+
+    private:
+        friend class MemoryStreamPool;
+
+        std::unique_ptr<MemoryBinaryStream> m_xStream;
+        std::weak_ptr<MemoryStreamPool*> m_xOwner;
+        std::thread::id m_OwnerThread;
+
+        Lease(std::unique_ptr<MemoryBinaryStream> inStream, const MemoryStreamPool& owner)
+            : m_xStream(std::move(inStream)), m_xOwner(owner.m_xSelf), m_OwnerThread(owner.m_Thread) {}
+
+        void give_back() noexcept
+        {
+            if (!m_xStream)
+            {
+                return;
+            }
+            // Only the owning thread destroys its pool, the check cannot race with it
+            std::shared_ptr<MemoryStreamPool*> xOwner;
+            if (m_OwnerThread == std::this_thread::get_id())
+            {
+                xOwner = m_xOwner.lock();
+            }
+            if (xOwner)
+            {
+                (*xOwner)->give_back(std::move(m_xStream));
+            }
+            m_xStream.reset();
+        }
+    };
+
+    MemoryStreamPool() : m_xSelf(std::make_shared<MemoryStreamPool*>(this)), m_Thread(std::this_thread::get_id()) {}
+    MemoryStreamPool(const MemoryStreamPool&) = delete;
+    MemoryStreamPool& operator=(const MemoryStreamPool&) = delete;
+
+    static MemoryStreamPool& local()
+    {
+        static thread_local MemoryStreamPool pool;
+        return pool;
+    }
+
+    /// Lease a stream, preferably one whose capacity holds expected_size bytes
+    Lease lease(size_t expected_size = 0)
+    {
+        size_t first = bucket(expected_size);
+        if (first < BUCKETS - 1 && ((size_t)1 << first) < expected_size)
+        {
+            ++first;// Round up, the streams of this bucket may be too small
+        }
+        for (size_t i = first; i < BUCKETS; ++i)
+        {
+            if (!m_Buckets[i].empty())
+            {
+                return take(i);
+            }
+        }
+        // Reuse a smaller stream rather than allocating a new one
+        for (size_t i = first; i-- > 0;)
+        {
+            if (!m_Buckets[i].empty())
+            {
+                Lease lease = take(i);
+                lease->reserve(expected_size);
+                return lease;
+            }
+        }
+        std::unique_ptr<MemoryBinaryStream> xStream(new MemoryBinaryStream());
+        xStream->reserve(expected_size);
+        return Lease(std::move(xStream), *this);
+    }
+
+    size_t retained() const { return m_Retained; }
+    size_t max_retained() const { return m_MaxRetained; }
+    void set_max_retained(size_t inMaxRetained) { m_MaxRetained = inMaxRetained; }
+
+private:
+    static const size_t BUCKETS = 48;
+    static const size_t MAX_RETAINED = 64 * 1024 * 1024;
+    std::vector<std::unique_ptr<MemoryBinaryStream>> m_Buckets[BUCKETS];
+    size_t m_Retained = 0;
+    size_t m_MaxRetained = MAX_RETAINED;
+    std::shared_ptr<MemoryStreamPool*> m_xSelf;// Expires with the pool, the leases hold a weak_ptr
+    std::thread::id m_Thread;
+
+    static size_t bucket(size_t capacity)
+    {
+        size_t result = 0;
+        while (capacity > 1 && result < BUCKETS - 1)
+        {
+            capacity >>= 1;
+            ++result;
+        }
+        return result;
+    }
+
+    Lease take(size_t index)
+    {
+        std::unique_ptr<MemoryBinaryStream> xStream(std::move(m_Buckets[index].back()));
+        m_Buckets[index].pop_back();
+        m_Retained -= xStream->capacity();
+        return Lease(std::move(xStream), *this);
+    }
+
+    void give_back(std::unique_ptr<MemoryBinaryStream> xStream) noexcept
+    {
+        size_t capacity = xStream->capacity();
+        if (m_Retained + capacity > m_MaxRetained)
+        {
+            return;// Freed
+        }
+        try
+        {
+            xStream->reset();
+            xStream->exceptions(std::ios_base::goodbit);
+            m_Buckets[bucket(capacity)].push_back(std::move(xStream));
+            m_Retained += capacity;
+        }
+        catch (...)
+        {
+            // The bucket could not grow, the stream is freed
+        }
+    }
+};
+
+/// Buffer shared by concurrent writers appending records and a single reader consuming them.
+/// A writer reserves a record with one fetch_add then fills it independently and commits it.
+/// The bytes are stored in zeroed segments allocated on demand and freed once read, 
+/// a record never spans two segments: it is at most segment_size() - 8 bytes long.
+/// The segment directory is a ring reusing the slots freed by the reader, so at most
+/// DIRECTORY_SIZE * LEAF_SIZE segments can be unread at the same time.
+/// A record reserved and not committed, because the writer threw or the segment could not
+/// be allocated, is skipped by the reader
+class ConcurrentMemoryBuffer
+{
+private:
+    // Each record starts with an 8 bytes header: the length and a state, 0 until committed
+    enum RecordState : uint64_t
+    {
+        Committed = 1,
+        Skipped = 2// End of a segment that cannot hold the record reserved
+    };
+
+    typedef std::atomic<uint64_t> tWord;
+
+    struct Leaf
+    {
+        std::atomic<tWord*> m_Segments[1024];
+    };
+
+    static const size_t LEAF_SIZE = 1024;
+    static const size_t DIRECTORY_SIZE = 1024;
+    static const size_t SEGMENT_SIZE = 1024 * 1024;
+    static const size_t HEADER_SIZE = sizeof(uint64_t);
+    static const uint64_t SLOT_COUNT = (uint64_t)DIRECTORY_SIZE * LEAF_SIZE;
+
+    const size_t m_SegmentSize;
+    std::atomic<Leaf*> m_Directory[DIRECTORY_SIZE];
+    std::atomic<uint64_t> m_Tail;
+    uint64_t m_Head;// Only used by the reader
+    std::atomic<uint64_t> m_Released;// First segment not freed, written by the reader only
+    std::mutex m_LostMutex;
+    std::vector<std::pair<uint64_t, uint64_t>> m_Lost;// Reserved regions without a segment to skip them
+    std::atomic<size_t> m_LostCount;
+
+public:
+    /// Skipped when destroyed without being committed
+    class Reservation
+    {
+    public:
+        Reservation(Reservation&& other) noexcept : m_pHeader(other.m_pHeader), m_pData(other.m_pData), m_Size(other.m_Size) 
+        {
+            other.m_pHeader = nullptr;
+        }
+
+        Reservation(const Reservation&) = delete;
+        Reservation& operator=(const Reservation&) = delete;
+
+        ~Reservation()
+        {
+            if (m_pHeader != nullptr)
+            {
+                skip(m_pHeader, HEADER_SIZE + align(m_Size));
+            }
+        }
+
+        uint8_t* data() const { return m_pData; }
+        size_t size() const { return m_Size; }
+
+    private:
+        friend class ConcurrentMemoryBuffer;
+        Reservation(tWord* pHeader, size_t inSize) : m_pHeader(pHeader), m_pData((uint8_t*)(pHeader + 1)), m_Size(inSize) {}
+
+        tWord* m_pHeader;// Null once committed
+        uint8_t* m_pData;
+        size_t m_Size;
+    };
+
+    ConcurrentMemoryBuffer(size_t inSegmentSize = SEGMENT_SIZE) 
+        : m_SegmentSize(std::max<size_t>(align(inSegmentSize), 2 * HEADER_SIZE)), m_Tail(0), m_Head(0), m_Released(0), m_LostCount(0)
+    {
+        for (auto& leaf : m_Directory)
+        {
+            leaf.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ConcurrentMemoryBuffer(const ConcurrentMemoryBuffer&) = delete;
+    ConcurrentMemoryBuffer& operator=(const ConcurrentMemoryBuffer&) = delete;
+
+    ~ConcurrentMemoryBuffer()
+    {
+        for (auto& leaf : m_Directory)
+        {
+            Leaf* pLeaf = leaf.load(std::memory_order_relaxed);
+            if (pLeaf != nullptr)
+            {
+                for (auto& segment : pLeaf->m_Segments)
+                {
+                    tWord* pSegment = segment.load(std::memory_order_relaxed);
+                    if (pSegment != creating())
+                    {
+                        delete[] pSegment;
+                    }
+                }
+                delete pLeaf;
+            }
+        }
+    }
+
+    size_t segment_size() const { return m_SegmentSize; }
+
+    /// Reserve n bytes to fill, visible to the reader after commit. Thread-safe
+    Reservation reserve(size_t n)
+    {
+        size_t recordSize = HEADER_SIZE + align(n);
+        if (recordSize > m_SegmentSize)
+        {
+            throw std::length_error("ConcurrentMemoryBuffer: record larger than a segment");
+        }
+        while (true)
+        {
+            uint64_t offset = m_Tail.fetch_add(recordSize, std::memory_order_relaxed);
+            uint64_t boundary = (offset / m_SegmentSize + 1) * m_SegmentSize;
+            uint64_t end = offset + recordSize;
+            tWord* pSegment = claimed_segment(offset, end);
+            if (end <= boundary)
+            {
+                return Reservation(pSegment + (offset % m_SegmentSize) / HEADER_SIZE, n);
+            }
+            // The record crosses a segment, skip both parts of the region and retry
+            skip(pSegment + (offset % m_SegmentSize) / HEADER_SIZE, boundary - offset);
+            skip(claimed_segment(boundary, end), end - boundary);
+        }
+    }
+
+    /// Make the record visible to the reader. Thread-safe
+    void commit(Reservation& reservation)
+    {
+        reservation.m_pHeader->store((Committed << 32) | reservation.m_Size, std::memory_order_release);
+        reservation.m_pHeader = nullptr;
+    }
+
+    /// Copy a record. Thread-safe
+    void append(const void* pValue, size_t n)
+    {
+        Reservation reservation = reserve(n);
+        memcpy(reservation.data(), pValue, n);
+        commit(reservation);
+    }
+
+    /// Return the next committed record, false if it is not committed yet. Records are 
+    /// read in reservation order. The view is valid until the next call. Single reader only
+    bool try_read(MemoryView& view)
+    {
+        // Free the segments read by the previous calls, their slots can then be reused
+        uint64_t released = m_Released.load(std::memory_order_relaxed);
+        if (released < m_Head / m_SegmentSize)
+        {
+            for (; released < m_Head / m_SegmentSize; ++released)
+            {
+                uint64_t slot = released % SLOT_COUNT;
+                Leaf* pLeaf = m_Directory[slot / LEAF_SIZE].load(std::memory_order_acquire);
+                if (pLeaf != nullptr)// Not created if all the regions of the segment were lost
+                {
+                    delete[] pLeaf->m_Segments[slot % LEAF_SIZE].exchange(nullptr, std::memory_order_relaxed);
+                }
+            }
+            m_Released.store(released, std::memory_order_release);
+        }
+
+        while (true)
+        {
+            tWord* pSegment = segment(m_Head / m_SegmentSize, false);
+            tWord* pHeader = pSegment != nullptr ? pSegment + (m_Head % m_SegmentSize) / HEADER_SIZE : nullptr;
+            uint64_t header = pHeader != nullptr ? pHeader->load(std::memory_order_acquire) : 0;
+            if (header == 0)
+            {
+                if (!skip_lost())
+                {
+                    return false;
+                }
+                continue;
+            }
+            size_t length = (size_t)(header & 0xffffffff);
+            m_Head += HEADER_SIZE + align(length);
+            if ((header >> 32) == Committed)
+            {
+                view = MemoryView((const uint8_t*)(pHeader + 1), length);
+                return true;
+            }
+        }
+    }
+
+private:
+    static size_t align(size_t n) { return (n + HEADER_SIZE - 1) & ~(HEADER_SIZE - 1); }
+
+    static void skip(tWord* pHeader, size_t size)
+    {
+        pHeader->store((Skipped << 32) | (size - HEADER_SIZE), std::memory_order_release);
+    }
+
+    /// Marks a slot whose segment is being allocated by another writer
+    static tWord* creating() { return reinterpret_cast<tWord*>(alignof(tWord)); }
+
+    /// Segment of the region [begin, end) reserved by the caller. If it cannot be created
+    /// the region is recorded as lost, so that the reader does not wait for it
+    tWord* claimed_segment(uint64_t begin, uint64_t end)
+    {
+        try
+        {
+            return segment(begin / m_SegmentSize, true);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_LostMutex);
+            m_Lost.emplace_back(begin, end);
+            m_LostCount.store(m_Lost.size(), std::memory_order_release);
+            throw;
+        }
+    }
+
+    /// Move the head past a lost region starting at it, false if there is none
+    bool skip_lost()
+    {
+        if (m_LostCount.load(std::memory_order_acquire) == 0)
+        {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m_LostMutex);
+        for (size_t i = 0; i < m_Lost.size(); ++i)
+        {
+            if (m_Lost[i].first == m_Head)
+            {
+                m_Head = m_Lost[i].second;
+                m_Lost.erase(m_Lost.begin() + i);
+                m_LostCount.store(m_Lost.size(), std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The slot of a segment holds either it or nothing: a writer creates the segment
+    // only after the reader has freed the one using the same slot a turn before.
+    // The reader never asks for a segment beyond the ones not freed yet
+    tWord* segment(uint64_t index, bool create)
+    {
+        if (create && index >= m_Released.load(std::memory_order_acquire) + SLOT_COUNT)
+        {
+            throw std::length_error("ConcurrentMemoryBuffer: capacity exceeded");
+        }
+        uint64_t slot = index % SLOT_COUNT;
+        std::atomic<Leaf*>& leaf = m_Directory[slot / LEAF_SIZE];
+        Leaf* pLeaf = leaf.load(std::memory_order_acquire);
+        if (pLeaf == nullptr)
+        {
+            if (!create)
+            {
+                return nullptr;
+            }
+            Leaf* pNew = new Leaf();// Value-initialized, the pointers are null
+            if (leaf.compare_exchange_strong(pLeaf, pNew, std::memory_order_acq_rel))
+            {
+                pLeaf = pNew;
+            }
+            else
+            {
+                delete pNew;
+            }
+        }
+
+        std::atomic<tWord*>& segment = pLeaf->m_Segments[slot % LEAF_SIZE];
+        tWord* pSegment = segment.load(std::memory_order_acquire);
+        if (!create)
+        {
+            return pSegment == creating() ? nullptr : pSegment;
+        }
+        // Only the writer installing the marker allocates the segment, the others wait for it
+        while (pSegment == nullptr || pSegment == creating())
+        {
+            if (pSegment == nullptr && segment.compare_exchange_weak(pSegment, creating(), std::memory_order_acquire))
+            {
+                try
+                {
+                    pSegment = new tWord[m_SegmentSize / HEADER_SIZE]();// Zeroed, the headers are not committed
+                }
+                catch (...)
+                {
+                    segment.store(nullptr, std::memory_order_release);
+                    throw;
+                }
+                segment.store(pSegment, std::memory_order_release);
+                break;
+            }
+            if (pSegment == creating())
+            {
+                std::this_thread::yield();
+                pSegment = segment.load(std::memory_order_acquire);
+            }
+        }
+        return pSegment;
+    }
+};
+
+/// Output buffer only counting the bytes written, to compute the exact size of a serialization
+class MeasuringBuffer : public std::streambuf
+{
+private:
+    size_t m_Size;
+
+public:
+    MeasuringBuffer() : m_Size(0) {}
+
+    size_t size() const { return m_Size; }
+
+protected:
+    virtual int_type overflow(int_type ch) override
+    {
+        if (ch != traits_type::eof())
+        {
+            ++m_Size;
+            return ch;
+        }
+        return traits_type::eof();
+    }
+
+    virtual std::streamsize xsputn(const char*, std::streamsize n) override
+    {
+        m_Size += n;
+        return n;
+    }
+};
+
+class MeasuringBinaryStream : private StreamBufferMember<MeasuringBuffer>, public std::ostream
+{
+public:
+    MeasuringBinaryStream() : std::ostream(&m_Buffer) {}
+
+    template <typename T>
+    MeasuringBinaryStream& operator<<(T value)
+    {
+        write((char*)&value, sizeof(T));
+        return *this;
+    }
+
+    MeasuringBinaryStream& operator<<(const char* pValue)
+    {
+        write((char*)pValue, strlen(pValue));
+        return *this;
+    }
+
+    size_t size() const { return m_Buffer.size(); }
+};
+
+/// Two passes serialization: writer is called with a MeasuringBinaryStream to compute the 
+/// exact size, then with a MemoryBinaryStream of this fixed capacity, allocated once.
+/// writer must accept both streams, e.g. a functor with a template operator()
+template <typename Writer>
+std::vector<uint8_t> write_exact(Writer writer)
+{
+    MeasuringBinaryStream measure;
+    writer(measure);
+
+    std::vector<uint8_t> result;
+    MemoryBinaryStream stream(result, GrowthPolicy::fixed(measure.size()));
+    writer(stream);
+    stream.flush();
+    return result;
+}
+
+/// Scatter/gather element, layout compatible with iovec to be passed to writev
+#if defined(__unix__) || defined(__APPLE__)
+using MemorySegment = iovec;
+#else
+struct MemorySegment
+{
+    void* iov_base;
+    size_t iov_len;
+};
+#endif
+
+/// Output buffer storing the bytes in a list of fixed size segments,
+/// growing never moves the bytes already written
+class SegmentedMemoryBuffer : public std::streambuf
+{
+private:
+    static const size_t SEGMENT_SIZE = 64 * 1024;
+    size_t m_SegmentSize;
+    std::vector<std::unique_ptr<uint8_t[]>> m_Segments;
+    size_t m_FullSegmentsSize;// Bytes stored in all the segments except the last one
+
+    void add_segment()
+    {
+        if (!m_Segments.empty())
+        {
+            m_FullSegmentsSize += pptr() - pbase();
+        }
+        m_Segments.emplace_back(new uint8_t[m_SegmentSize]);// Not value-initialized
+        char* segment = (char*)m_Segments.back().get();
+        setp(segment, segment + m_SegmentSize);
+    }
+
+public:
+    SegmentedMemoryBuffer(size_t inSegmentSize = SEGMENT_SIZE) : m_SegmentSize(inSegmentSize), m_FullSegmentsSize(0)
+    {
+        // An empty segment would never make room for the next byte
+        if (m_SegmentSize == 0)
+        {
+            throw std::invalid_argument("SegmentedMemoryBuffer: segment size must be greater than 0");
+        }
+        add_segment();
+    }
+
+    size_t size() const { return m_FullSegmentsSize + (pptr() - pbase()); }
+
+    /// Scatter/gather list of the bytes written, valid until the next write
+    std::vector<MemorySegment> segments() const
+    {
+        std::vector<MemorySegment> result;
+        result.reserve(m_Segments.size());
+        for (size_t i = 0; i < m_Segments.size(); ++i)
+        {
+            MemorySegment segment;
+            segment.iov_base = m_Segments[i].get();
+            segment.iov_len = (i + 1 < m_Segments.size()) ? m_SegmentSize : (size_t)(pptr() - pbase());
+            if (segment.iov_len > 0)
+            {
+                result.push_back(segment);
+            }
+        }
+        return result;
+    }
+
+    /// Copy the bytes written into a single contiguous vector
+    std::vector<uint8_t> flatten() const
+    {
+        std::vector<uint8_t> result;
+        result.reserve(size());
+        for (const auto& segment : segments())
+        {
+            const uint8_t* first = (const uint8_t*)segment.iov_base;
+            result.insert(result.end(), first, first + segment.iov_len);
+        }
+        return result;
+    }
+
+protected:
+    virtual int_type overflow(int_type ch) override
+    {
+        if (ch != traits_type::eof())
+        {
+            add_segment();
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+            return ch;
+        }
+        return traits_type::eof();
+    }
+
+    virtual std::streamsize xsputn(const char* s, std::streamsize n) override
+    {
+        std::streamsize written = 0;
+        while (written < n)
+        {
+            if (pptr() == epptr())
+            {
+                add_segment();
+            }
+            std::streamsize count = std::min<std::streamsize>(epptr() - pptr(), n - written);
+            memcpy(pptr(), s + written, count);
+            pbump(count);
+            written += count;
+        }
+        return n;
+    }
+
+    // Only tellp is supported, the bytes are never moved so there is no random access
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+    {
+        if (off == 0 && dir == std::ios_base::cur && (which & std::ios_base::out))
+        {
+            return size();
+        }
+        return pos_type(off_type(-1));
+    }
+};
+
+class SegmentedMemoryBinaryStream : private StreamBufferMember<SegmentedMemoryBuffer>, public std::ostream
+{
+public:
+    SegmentedMemoryBinaryStream() : std::ostream(&m_Buffer) {}
+    SegmentedMemoryBinaryStream(size_t inSegmentSize) : StreamBufferMember<SegmentedMemoryBuffer>(inSegmentSize), std::ostream(&m_Buffer) {}
+
+    template <typename T>
+    SegmentedMemoryBinaryStream& operator<<(T value)
+    {
+        write((char*)&value, sizeof(T));
+        return *this;
+    }
+
+    SegmentedMemoryBinaryStream& operator<<(const char* pValue)
+    {
+        write((char*)pValue, strlen(pValue));
+        return *this;
+    }
+
+    size_t size() const { return m_Buffer.size(); }
+    std::vector<MemorySegment> segments() const { return m_Buffer.segments(); }
+    std::vector<uint8_t> flatten() const { return m_Buffer.flatten(); }
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+/// Buffer writing into a memory mapped file growing with ftruncate and remap, 
+/// or reading an existing file without copying it
+class MappedFileBuffer : public std::streambuf
+{
+public:
+    enum Mode
+    {
+        Read,
+        Write// Create or truncate the file
+    };
+
+    MappedFileBuffer(const std::string& inPath, Mode inMode, GrowthPolicy inGrowth = GrowthPolicy::geometric(RESERVE_SIZE)) 
+        : m_Mode(inMode), m_Growth(inGrowth), m_pData(nullptr), m_Capacity(0), m_Size(0)
+    {
+        m_File = ::open(inPath.c_str(), m_Mode == Read ? O_RDONLY : (O_RDWR | O_CREAT | O_TRUNC), 0644);
+        if (m_File < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "MappedFileBuffer: cannot open " + inPath);
+        }
+
+        // The destructor does not run if the constructor throws
+        try
+        {
+            if (m_Mode == Read)
+            {
+                struct stat status;
+                if (fstat(m_File, &status) != 0)
+                {
+                    throw std::system_error(errno, std::generic_category(), "MappedFileBuffer: cannot stat " + inPath);
+                }
+                m_Size = status.st_size;
+                map(m_Size);
+                setg(m_pData, m_pData, m_pData + m_Size);
+            }
+            else
+            {
+                map(m_Growth.initial_capacity());
+                setp(m_pData, m_pData + m_Capacity);
+            }
+        }
+        catch (...)
+        {
+            release();
+            throw;
+        }
+    }
+
+    MappedFileBuffer(const MappedFileBuffer&) = delete;
+    MappedFileBuffer& operator=(const MappedFileBuffer&) = delete;
+
+    /// The file keeps the size of the mapping if it cannot be truncated
+    ~MappedFileBuffer() { release(); }
+
+    /// Bytes written, or size of the file read
+    size_t size() const { return std::max(m_Size, (size_t)(pptr() - pbase())); }
+
+    /// Return a view of the next n bytes of the mapped file and skip them,
+    /// an empty view if less than n bytes are available
+    MemoryView read_view(size_t n)
+    {
+        if ((size_t)(egptr() - gptr()) < n)
+        {
+            return MemoryView();
+        }
+        MemoryView view((const uint8_t*)gptr(), n);
+        setg(eback(), gptr() + n, egptr());
+        return view;
+    }
+
+    /// Unmap the file and truncate it to the bytes written, throws std::system_error
+    /// if the file cannot be truncated
+    void close()
+    {
+        int error = release();
+        if (error != 0)
+        {
+            throw std::system_error(error, std::generic_category(), "MappedFileBuffer: cannot truncate the file");
+        }
+    }
+
+protected:
+    virtual int_type overflow(int_type ch) override
+    {
+        if (ch != traits_type::eof())
+        {
+            expand_buffer(1);
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+            return ch;
+        }
+        return traits_type::eof();
+    }
+
+    virtual std::streamsize xsputn(const char* s, std::streamsize n) override
+    {
+        if (epptr() - pptr() < n)
+        {
+            expand_buffer(n);
+        }
+        memcpy(pptr(), s, n);
+        advance_put(n);
+        return n;
+    }
+
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+    {
+        char* pCurrent = (m_Mode == Read) ? gptr() : pptr();
+        char* pNew = nullptr;
+        switch (dir)
+        {
+        case std::ios_base::beg:
+            pNew = m_pData + off;
+            break;
+        case std::ios_base::cur:
+            pNew = pCurrent + off;
+            break;
+        case std::ios_base::end:
+            pNew = m_pData + size() + off;
+            break;
+        default:
+            break;
+        }
+        bool valid = (m_Mode == Read) ? (which & std::ios_base::in) != 0 : (which & std::ios_base::out) != 0;
+        if (!valid || pNew < m_pData || pNew > m_pData + size())
+        {
+            return pos_type(off_type(-1));
+        }
+        if (m_Mode == Read)
+        {
+            setg(m_pData, pNew, m_pData + m_Size);
+        }
+        else
+        {
+            m_Size = size();
+            setp(m_pData, m_pData + m_Capacity);
+            advance_put(pNew - m_pData);
+        }
+        return pNew - m_pData;
+    }
+
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which) override { return seekoff(pos, std::ios_base::beg, which); }
+
+private:
+    static const size_t RESERVE_SIZE = 1024 * 1024;
+    int m_File;
+    Mode m_Mode;
+    GrowthPolicy m_Growth;
+    char* m_pData;
+    size_t m_Capacity;
+    size_t m_Size;// Bytes written before the last seekp or remap
+
+    /// Unmap and close the file, returns the errno of the failed truncation or 0
+    int release() noexcept
+    {
+        if (m_File < 0)
+        {
+            return 0;
+        }
+        size_t written = size();
+        if (m_pData != nullptr)
+        {
+            munmap(m_pData, m_Capacity);
+            m_pData = nullptr;
+        }
+        int error = 0;
+        if (m_Mode == Write && ftruncate(m_File, written) != 0)
+        {
+            error = errno;
+        }
+        ::close(m_File);
+        m_File = -1;
+        setp(nullptr, nullptr);
+        setg(nullptr, nullptr, nullptr);
+        return error;
+    }
+
+    // pbump takes an int, files can be larger than 2 GB
+    void advance_put(size_t n)
+    {
+        while (n > 0)
+        {
+            int step = (int)std::min<size_t>(n, INT_MAX);
+            pbump(step);
+            n -= step;
+        }
+    }
+
+    void map(size_t capacity)
+    {
+        if (capacity == 0)
+        {
+            return;// mmap rejects empty mappings
+        }
+        if (m_Mode == Write && ftruncate(m_File, capacity) != 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "MappedFileBuffer: cannot grow the file");
+        }
+        void* pData = MAP_FAILED;
+#if defined(__linux__)
+        if (m_pData != nullptr)
+        {
+            pData = mremap(m_pData, m_Capacity, capacity, MREMAP_MAYMOVE);
+        }
+        else
+#endif
+        {
+            int protection = (m_Mode == Read) ? PROT_READ : (PROT_READ | PROT_WRITE);
+            pData = mmap(nullptr, capacity, protection, m_Mode == Read ? MAP_PRIVATE : MAP_SHARED, m_File, 0);
+        }
+        if (pData == MAP_FAILED)
+        {
+            // The previous mapping and the put area are still valid, the stream can be
+            // used after the exception. Shrinking the file back is best effort, close()
+            // truncates it to the bytes written in any case.
+            int error = errno;
+            if (m_Mode == Write && m_pData != nullptr)
+            {
+                (void)(ftruncate(m_File, m_Capacity) == 0);
+            }
+            throw std::system_error(error, std::generic_category(), "MappedFileBuffer: cannot map the file");
+        }
+#if !defined(__linux__)
+        if (m_pData != nullptr)
+        {
+            munmap(m_pData, m_Capacity);// The new mapping is created first, it replaces the previous one
+        }
+#endif
+        m_pData = (char*)pData;
+        m_Capacity = capacity;
+    }
+
+    void expand_buffer(size_t additional_size)
+    {
+        size_t putOffset = pptr() - pbase();
+        m_Size = size();
+        map(m_Growth.next_capacity(m_Capacity, std::max(m_Size, putOffset + additional_size)));
+        setp(m_pData, m_pData + m_Capacity);
+        advance_put(putOffset);
+    }
+};
+
+class MappedFileBinaryStream : private StreamBufferMember<MappedFileBuffer>, public std::iostream
+{
+public:
+    MappedFileBinaryStream(const std::string& inPath, MappedFileBuffer::Mode inMode) 
+        : StreamBufferMember<MappedFileBuffer>(inPath, inMode), std::iostream(&m_Buffer) {}
+    MappedFileBinaryStream(const std::string& inPath, MappedFileBuffer::Mode inMode, GrowthPolicy inGrowth) 
+        : StreamBufferMember<MappedFileBuffer>(inPath, inMode, inGrowth), std::iostream(&m_Buffer) {}
+
+    template <typename T>
+    MappedFileBinaryStream& operator<<(T value)
+    {
+        write((char*)&value, sizeof(T));
+        return *this;
+    }
+
+    MappedFileBinaryStream& operator<<(const char* pValue)
+    {
+        write((char*)pValue, strlen(pValue));
+        return *this;
+    }
+
+    template <typename T, typename = typename std::enable_if<std::is_trivially_copyable<T>::value>::type>
+    MappedFileBinaryStream& operator>>(T& value)
+    {
+        read((char*)&value, sizeof(T));
+        return *this;
+    }
+
+    /// Zero-copy read of the next n bytes, sets failbit if less than n bytes are available
+    MemoryView read_view(size_t n)
+    {
+        MemoryView view = m_Buffer.read_view(n);
+        if (view.size() != n)
+        {
+            setstate(std::ios_base::failbit | std::ios_base::eofbit);
+        }
+        return view;
+    }
+
+    size_t size() const { return m_Buffer.size(); }
+    void close() { m_Buffer.close(); }
+};
+#endif
+
+enum class Endian
+{
+    Little,
+    Big,
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    Native = Big
+#else
+    Native = Little
+#endif
+};
+
+/// Portable encodings on top of MemoryBinaryStream: LEB128 varints, zigzag for signed values,
+/// fixed-width values of explicit endianness and length-prefixed strings.
+/// The read functions set failbit on the stream and return false when the data is truncated or malformed
+class BinaryEncoding
+{
+public:
+    static uint64_t zigzag_encode(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+    static int64_t zigzag_decode(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+    static void write_varint(MemoryBinaryStream& stream, uint64_t value)
+    {
+        uint8_t bytes[MAX_VARINT_SIZE];
+        stream.put_bytes(bytes, encode_varint(bytes, value));
+    }
+
+    /// Only the shortest encoding of a value is accepted
+    static bool read_varint(MemoryBinaryStream& stream, uint64_t& value)
+    {
+        MemoryView view = stream.peek_view();
+        size_t size = decode_varint(view.data(), view.data() + view.size(), value);
+        if (size == 0)
+        {
+            return fail(stream);
+        }
+        stream.read_view(size);
+        return true;
+    }
+
+    /// Bulk varints, the values are encoded in a local buffer and written a chunk at a time
+    static void write_varint_array(MemoryBinaryStream& stream, const uint64_t* pValues, size_t count)
+    {
+        const size_t chunk = 64;
+        uint8_t bytes[chunk * MAX_VARINT_SIZE];
+        for (size_t i = 0; i < count; i += chunk)
+        {
+            size_t last = std::min(count, i + chunk);
+            size_t size = 0;
+            for (size_t j = i; j < last; ++j)
+            {
+                size += encode_varint(bytes + size, pValues[j]);
+            }
+            stream.put_bytes(bytes, size);
+        }
+    }
+
+    /// Reads 8 bytes at a time while none of them has the continuation bit, 
+    /// nothing is consumed from the stream when a value is truncated or malformed
+    static bool read_varint_array(MemoryBinaryStream& stream, uint64_t* pValues, size_t count)
+    {
+        MemoryView view = stream.peek_view();
+        const uint8_t* pData = view.data();
+        const uint8_t* pEnd = pData + view.size();
+        size_t i = 0;
+        while (i < count)
+        {
+            uint64_t word = 0;
+            if (count - i >= 8 && pEnd - pData >= 8)
+            {
+                memcpy(&word, pData, sizeof(word));
+            }
+            if (count - i >= 8 && pEnd - pData >= 8 && (word & 0x8080808080808080ull) == 0)
+            {
+                for (size_t k = 0; k < 8; ++k)
+                {
+                    pValues[i + k] = pData[k];
+                }
+                i += 8;
+                pData += 8;
+                continue;
+            }
+            size_t size = decode_varint(pData, pEnd, pValues[i]);
+            if (size == 0)
+            {
+                return fail(stream);
+            }
+            pData += size;
+            ++i;
+        }
+        stream.read_view(pData - view.data());
+        return true;
+    }
+
+    static void write_signed_varint(MemoryBinaryStream& stream, int64_t value) { write_varint(stream, zigzag_encode(value)); }
+
+    static bool read_signed_varint(MemoryBinaryStream& stream, int64_t& value)
+    {
+        uint64_t encoded = 0;
+        if (!read_varint(stream, encoded))
+        {
+            return false;
+        }
+        value = zigzag_decode(encoded);
+        return true;
+    }
+
+    template <Endian E, typename T>
+    static void write_fixed(MemoryBinaryStream& stream, T value)
+    {
+        write_fixed_array<E>(stream, &value, 1);
+    }
+
+    template <Endian E, typename T>
+    static bool read_fixed(MemoryBinaryStream& stream, T& value)
+    {
+        return read_fixed_array<E>(stream, &value, 1);
+    }
+
+    /// Bulk writes, the byte swap uses SSSE3 when the CPU supports it
+    template <Endian E, typename T>
+    static void write_fixed_array(MemoryBinaryStream& stream, const T* pValues, size_t count)
+    {
+        static_assert(std::is_arithmetic<T>::value, "Fixed-width encoding requires an arithmetic type");
+        static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8,
+            "Fixed-width encoding supports 1, 2, 4 and 8 bytes types, long double has no portable layout");
+        if (E == Endian::Native || sizeof(T) == 1)
+        {
+            stream.put_bytes(pValues, count * sizeof(T));
+        }
+        else
+        {
+            swap_copy<sizeof(T)>(stream.reserve_and_get(count * sizeof(T)), (const uint8_t*)pValues, count);
+        }
+    }
+
+    template <Endian E, typename T>
+    static bool read_fixed_array(MemoryBinaryStream& stream, T* pValues, size_t count)
+    {
+        static_assert(std::is_arithmetic<T>::value, "Fixed-width encoding requires an arithmetic type");
+        static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8,
+            "Fixed-width encoding supports 1, 2, 4 and 8 bytes types, long double has no portable layout");
+        MemoryView view = stream.read_view(count * sizeof(T));
+        if (view.size() != count * sizeof(T))
+        {
+            return false;
+        }
+        if (E == Endian::Native || sizeof(T) == 1)
+        {
+            memcpy(pValues, view.data(), view.size());
+        }
+        else
+        {
+            swap_copy<sizeof(T)>((uint8_t*)pValues, view.data(), count);
+        }
+        return true;
+    }
+
+    /// Varint length followed by the bytes, unlike operator<<(const char*) the strings can be read back
+    static void write_string(MemoryBinaryStream& stream, const char* pValue, size_t size)
+    {
+        write_varint(stream, size);
+        stream.put_bytes(pValue, size);
+    }
+
+    static void write_string(MemoryBinaryStream& stream, const std::string& value) { write_string(stream, value.data(), value.size()); }
+
+    static bool read_string(MemoryBinaryStream& stream, std::string& value)
+    {
+        uint64_t size = 0;
+        if (!read_varint(stream, size))
+        {
+            return false;
+        }
+        MemoryView view = stream.read_view(size);
+        if (view.size() != size)
+        {
+            return false;
+        }
+        value.assign((const char*)view.data(), view.size());
+        return true;
+    }
+
+    /// Group varint: a tag byte holding the sizes of the next 4 values, then the values 
+    /// in 1 to 4 little-endian bytes. count is not stored, the last group is padded with zeros.
+    /// The decoding uses SSSE3 shuffles when the CPU supports it, the encoding is scalar
+    static void write_group_varint(MemoryBinaryStream& stream, const uint32_t* pValues, size_t count)
+    {
+        for (size_t i = 0; i < count; i += 4)
+        {
+            uint8_t group[GROUP_VARINT_SIZE];
+            uint8_t tag = 0;
+            size_t size = 1;
+            for (size_t j = 0; j < 4; ++j)
+            {
+                uint32_t value = (i + j < count) ? pValues[i + j] : 0;
+                size_t length = 1 + (value > 0xff) + (value > 0xffff) + (value > 0xffffff);
+                tag |= (uint8_t)((length - 1) << (2 * j));
+                for (size_t k = 0; k < length; ++k)
+                {
+                    group[size++] = (uint8_t)(value >> (8 * k));
+                }
+            }
+            group[0] = tag;
+            stream.put_bytes(group, size);
+        }
+    }
+
+    static bool read_group_varint(MemoryBinaryStream& stream, uint32_t* pValues, size_t count)
+    {
+        MemoryView view = stream.peek_view();
+        const uint8_t* pData = view.data();
+        const uint8_t* pEnd = pData + view.size();
+        size_t i = 0;
+#if defined(MEMORY_BINARY_STREAM_SSSE3)
+        if (Endian::Native == Endian::Little && ssse3_supported())
+        {
+            i = read_groups_ssse3(pData, pEnd, pValues, count);
+        }
+#endif
+        // The last groups, or all of them without SSSE3
+        for (; i < count; i += 4)
+        {
+            if (pData == pEnd)
+            {
+                return fail(stream);
+            }
+            uint8_t tag = *pData;
+            size_t size = group_size(tag);
+            if ((size_t)(pEnd - pData) < size)
+            {
+                return fail(stream);
+            }
+            uint32_t values[4];
+            const uint8_t* pByte = pData + 1;
+            for (size_t j = 0; j < 4; ++j)
+            {
+                size_t length = ((tag >> (2 * j)) & 3) + 1;
+                values[j] = 0;
+                for (size_t k = 0; k < length; ++k)
+                {
+                    values[j] |= (uint32_t)*pByte++ << (8 * k);
+                }
+            }
+            memcpy(pValues + i, values, std::min<size_t>(4, count - i) * sizeof(uint32_t));
+            pData += size;
+        }
+        stream.read_view(pData - view.data());
+        return true;
+    }
+
+private:
+    static const size_t MAX_VARINT_SIZE = 10;
+    static const size_t GROUP_VARINT_SIZE = 17;
+
+    static bool fail(MemoryBinaryStream& stream)
+    {
+        stream.setstate(std::ios_base::failbit | std::ios_base::eofbit);
+        return false;
+    }
+
+    static size_t encode_varint(uint8_t* pBytes, uint64_t value)
+    {
+        size_t size = 0;
+        while (value >= 0x80)
+        {
+            pBytes[size++] = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        pBytes[size++] = (uint8_t)value;
+        return size;
+    }
+
+    /// Return the size of the varint, 0 when it is truncated, overlong (a zero last byte after 
+    /// the first one) or when the 10th byte holds more than bit 63
+    static size_t decode_varint(const uint8_t* pData, const uint8_t* pEnd, uint64_t& value)
+    {
+        size_t size = std::min<size_t>(pEnd - pData, (size_t)MAX_VARINT_SIZE);
+        uint64_t result = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            uint8_t byte = pData[i];
+            if (i == MAX_VARINT_SIZE - 1 && byte > 1)
+            {
+                return 0;
+            }
+            result |= (uint64_t)(byte & 0x7f) << (7 * i);
+            if (byte < 0x80)
+            {
+                if (byte == 0 && i > 0)
+                {
+                    return 0;
+                }
+                value = result;
+                return i + 1;
+            }
+        }
+        return 0;
+    }
+
+    static size_t group_size(uint8_t tag)
+    {
+        return 1 + (tag & 3) + ((tag >> 2) & 3) + ((tag >> 4) & 3) + ((tag >> 6) & 3) + 4;
+    }
+
+#if defined(MEMORY_BINARY_STREAM_SSSE3)
+    static bool ssse3_supported()
+    {
+        static const bool supported = __builtin_cpu_supports("ssse3");
+        return supported;
+    }
+
+    struct GroupShuffleTable
+    {
+        alignas(16) uint8_t m_Masks[256][16];
+
+        GroupShuffleTable()
+        {
+            for (size_t tag = 0; tag < 256; ++tag)
+            {
+                uint8_t source = 0;
+                for (size_t j = 0; j < 4; ++j)
+                {
+                    size_t length = ((tag >> (2 * j)) & 3) + 1;
+                    for (size_t k = 0; k < 4; ++k)
+                    {
+                        m_Masks[tag][4 * j + k] = (k < length) ? source++ : 0x80;// 0x80 writes a zero
+                    }
+                }
+            }
+        }
+    };
+
+    static const GroupShuffleTable& group_shuffle_table()
+    {
+        static const GroupShuffleTable table;
+        return table;
+    }
+
+    /// Decode the groups while 16 bytes can be loaded after the tag, advance pData
+    /// and return the number of values decoded
+    __attribute__((target("ssse3")))
+    static size_t read_groups_ssse3(const uint8_t*& pData, const uint8_t* pEnd, uint32_t* pValues, size_t count)
+    {
+        const GroupShuffleTable& table = group_shuffle_table();
+        size_t i = 0;
+        for (; i < count && (size_t)(pEnd - pData) >= 1 + sizeof(__m128i); i += 4)
+        {
+            // The shuffle moves each value to its 4 bytes lane
+            uint8_t tag = *pData;
+            uint32_t values[4];
+            __m128i data = _mm_loadu_si128((const __m128i*)(pData + 1));
+            __m128i mask = _mm_load_si128((const __m128i*)table.m_Masks[tag]);
+            _mm_storeu_si128((__m128i*)values, _mm_shuffle_epi8(data, mask));
+            memcpy(pValues + i, values, std::min<size_t>(4, count - i) * sizeof(uint32_t));
+            pData += group_size(tag);
+        }
+        return i;
+    }
+
+    /// Reverse the bytes of each value 16 bytes at a time, return the number of values copied
+    template <size_t Size>
+    __attribute__((target("ssse3")))
+    static size_t swap_copy_ssse3(uint8_t* pDestination, const uint8_t* pSource, size_t count)
+    {
+        uint8_t reverse[16];
+        for (size_t k = 0; k < 16; ++k)
+        {
+            reverse[k] = (uint8_t)((k / Size) * Size + (Size - 1 - k % Size));
+        }
+        __m128i mask = _mm_loadu_si128((const __m128i*)reverse);
+        const size_t perVector = 16 / Size;
+        size_t i = 0;
+        for (; i + perVector <= count; i += perVector)
+        {
+            __m128i data = _mm_loadu_si128((const __m128i*)(pSource + i * Size));
+            _mm_storeu_si128((__m128i*)(pDestination + i * Size), _mm_shuffle_epi8(data, mask));
+        }
+        return i;
+    }
+#endif
+
+    static uint8_t byte_swap(uint8_t value) { return value; }
+    static uint16_t byte_swap(uint16_t value) { return (uint16_t)((value >> 8) | (value << 8)); }
+    static uint32_t byte_swap(uint32_t value)
+    {
+#if defined(__GNUC__)
+        return __builtin_bswap32(value);
+#else
+        return ((uint32_t)byte_swap((uint16_t)value) << 16) | byte_swap((uint16_t)(value >> 16));
+#endif
+    }
+    static uint64_t byte_swap(uint64_t value)
+    {
+#if defined(__GNUC__)
+        return __builtin_bswap64(value);
+#else
+        return ((uint64_t)byte_swap((uint32_t)value) << 32) | byte_swap((uint32_t)(value >> 32));
+#endif
+    }
+
+    template <size_t Size> struct Unsigned;
+
+    template <size_t Size>
+    static void swap_copy(uint8_t* pDestination, const uint8_t* pSource, size_t count)
+    {
+        typedef typename Unsigned<Size>::type tUnsigned;
+        size_t i = 0;
+#if defined(MEMORY_BINARY_STREAM_SSSE3)
+        if (count >= 16 / Size && ssse3_supported())
+        {
+            i = swap_copy_ssse3<Size>(pDestination, pSource, count);
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            tUnsigned value;
+            memcpy(&value, pSource + i * Size, Size);
+            value = byte_swap(value);
+            memcpy(pDestination + i * Size, &value, Size);
+        }
+    }
+};
+
+template <> struct BinaryEncoding::Unsigned<1> { typedef uint8_t type; };
+template <> struct BinaryEncoding::Unsigned<2> { typedef uint16_t type; };
+template <> struct BinaryEncoding::Unsigned<4> { typedef uint32_t type; };
+template <> struct BinaryEncoding::Unsigned<8> { typedef uint64_t type; };
+
+/// CRC32C (Castagnoli), using the SSE4.2 instruction when the CPU supports it, 
+/// selected at run time, and slicing-by-8 tables otherwise
+class Crc32c
+{
+public:
+    /// crc is the result of a previous call to extend a checksum
+    static uint32_t compute(const void* pData, size_t n, uint32_t crc = 0)
+    {
+        static const tImplementation implementation = select();
+        return implementation((const uint8_t*)pData, n, crc);
+    }
+
+    static uint32_t compute_software(const void* pData, size_t n, uint32_t crc = 0)
+    {
+        return software((const uint8_t*)pData, n, crc);
+    }
+
+    static bool hardware_supported()
+    {
+#if defined(MEMORY_BINARY_STREAM_CRC32C_SSE42)
+        return __builtin_cpu_supports("sse4.2");
+#else
+        return false;
+#endif
+    }
+
+private:
+    typedef uint32_t (*tImplementation)(const uint8_t*, size_t, uint32_t);
+
+    static tImplementation select()
+    {
+#if defined(MEMORY_BINARY_STREAM_CRC32C_SSE42)
+        if (hardware_supported())
+        {
+            return &hardware;
+        }
+#endif
+        return &software;
+    }
+
+    struct Tables
+    {
+        uint32_t m_Values[8][256];
+
+        Tables()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+                }
+                m_Values[0][i] = crc;
+            }
+            for (size_t k = 1; k < 8; ++k)
+            {
+                for (uint32_t i = 0; i < 256; ++i)
+                {
+                    m_Values[k][i] = (m_Values[k - 1][i] >> 8) ^ m_Values[0][m_Values[k - 1][i] & 0xff];
+                }
+            }
+        }
+    };
+
+    static uint32_t software(const uint8_t* pData, size_t n, uint32_t crc)
+    {
+        static const Tables tables;
+        const uint32_t (*t)[256] = tables.m_Values;
+        crc = ~crc;
+        for (; n >= 8; n -= 8, pData += 8)
+        {
+            uint32_t low = crc ^ (pData[0] | ((uint32_t)pData[1] << 8) | ((uint32_t)pData[2] << 16) | ((uint32_t)pData[3] << 24));
+            crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] 
+                ^ t[3][pData[4]] ^ t[2][pData[5]] ^ t[1][pData[6]] ^ t[0][pData[7]];
+        }
+        for (; n > 0; --n, ++pData)
+        {
+            crc = t[0][(crc ^ *pData) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+#if defined(MEMORY_BINARY_STREAM_CRC32C_SSE42)
+    __attribute__((target("sse4.2")))
+    static uint32_t hardware(const uint8_t* pData, size_t n, uint32_t crc)
+    {
+        crc = ~crc;
+#if defined(__x86_64__)
+        uint64_t crc64 = crc;
+        for (; n >= 8; n -= 8, pData += 8)
+        {
+            uint64_t value;
+            memcpy(&value, pData, sizeof(value));
+            crc64 = _mm_crc32_u64(crc64, value);
+        }
+        crc = (uint32_t)crc64;
+#endif
+        for (; n >= 4; n -= 4, pData += 4)
+        {
+            uint32_t value;
+            memcpy(&value, pData, sizeof(value));
+            crc = _mm_crc32_u32(crc, value);
+        }
+        for (; n > 0; --n, ++pData)
+        {
+            crc = _mm_crc32_u8(crc, *pData);
+        }
+        return ~crc;
+    }
+#endif
+};
+
+/// Record framing on top of MemoryBinaryStream: a magic number to resynchronize after a 
+/// corruption, the little-endian payload length and record type, a CRC32C of these two fields
+/// checked before the length is used, a CRC32C of the payload, then the payload
+class RecordFormat
+{
+public:
+    static const uint32_t MAGIC = 0x5243d1f1u;
+    static const size_t HEADER_SIZE = 5 * sizeof(uint32_t);
+    static const size_t MAX_LENGTH = 256 * 1024 * 1024;// Larger lengths are corruptions
+
+    static void write_le32(uint8_t* pData, uint32_t value)
+    {
+        for (size_t i = 0; i < sizeof(uint32_t); ++i)
+        {
+            pData[i] = (uint8_t)(value >> (8 * i));
+        }
+    }
+
+    static uint32_t read_le32(const uint8_t* pData)
+    {
+        return pData[0] | ((uint32_t)pData[1] << 8) | ((uint32_t)pData[2] << 16) | ((uint32_t)pData[3] << 24);
+    }
+
+    static uint32_t header_checksum(const uint8_t* pHeader)
+    {
+        return Crc32c::compute(pHeader + 4, 8);
+    }
+
+    static uint32_t payload_checksum(const uint8_t* pPayload, size_t length)
+    {
+        return Crc32c::compute(pPayload, length);
+    }
+};
+
+class RecordWriter
+{
+public:
+    RecordWriter(MemoryBinaryStream& inStream) : m_Stream(inStream) {}
+
+    void write(uint32_t type, const void* pPayload, size_t length)
+    {
+        if (length > RecordFormat::MAX_LENGTH)
+        {
+            throw std::length_error("RecordWriter: record too large");
+        }
+        uint8_t* pRecord = m_Stream.reserve_and_get(RecordFormat::HEADER_SIZE + length);
+        RecordFormat::write_le32(pRecord, RecordFormat::MAGIC);
+        RecordFormat::write_le32(pRecord + 4, (uint32_t)length);
+        RecordFormat::write_le32(pRecord + 8, type);
+        RecordFormat::write_le32(pRecord + 12, RecordFormat::header_checksum(pRecord));
+        memcpy(pRecord + RecordFormat::HEADER_SIZE, pPayload, length);
+        RecordFormat::write_le32(pRecord + 16, RecordFormat::payload_checksum(pRecord + RecordFormat::HEADER_SIZE, length));
+    }
+
+private:
+    MemoryBinaryStream& m_Stream;
+};
+
+/// Read the records of a MemoryBinaryStream, skipping the corrupted bytes up to the next valid record
+class RecordReader
+{
+public:
+    struct Record
+    {
+        uint32_t m_Type;
+        MemoryView m_Payload;// Valid until the next write to the stream
+    };
+
+    RecordReader(MemoryBinaryStream& inStream) : m_Stream(inStream), m_SkippedBytes(0), m_Corruptions(0) {}
+
+    /// Return false when no complete record is available, the stream may be extended and read again
+    bool next(Record& record)
+    {
+        while (true)
+        {
+            MemoryView view = m_Stream.peek_view();
+            const uint8_t* pData = view.data();
+            size_t available = view.size();
+            if (available < RecordFormat::HEADER_SIZE)
+            {
+                return false;
+            }
+
+            // The length is trusted only once the header checksum matches, a corrupted
+            // length would otherwise make the rest of the stream look incomplete
+            uint32_t length = RecordFormat::read_le32(pData + 4);
+            bool valid = RecordFormat::read_le32(pData) == RecordFormat::MAGIC 
+                && RecordFormat::read_le32(pData + 12) == RecordFormat::header_checksum(pData) 
+                && length <= RecordFormat::MAX_LENGTH;
+            if (valid && available - RecordFormat::HEADER_SIZE < length)
+            {
+                return false;// Incomplete
+            }
+            if (valid && RecordFormat::read_le32(pData + 16) == RecordFormat::payload_checksum(pData + RecordFormat::HEADER_SIZE, length))
+            {
+                record.m_Type = RecordFormat::read_le32(pData + 8);
+                record.m_Payload = MemoryView(pData + RecordFormat::HEADER_SIZE, length);
+                m_Stream.read_view(RecordFormat::HEADER_SIZE + length);
+                return true;
+            }
+
+            // Resynchronize on the next magic number
+            ++m_Corruptions;
+            size_t skipped = 1;
+            while (skipped + sizeof(uint32_t) <= available && RecordFormat::read_le32(pData + skipped) != RecordFormat::MAGIC)
+            {
+                ++skipped;
+            }
+            if (skipped + sizeof(uint32_t) > available)
+            {
+                skipped = available - (sizeof(uint32_t) - 1);// Keep a possible partial magic number
+            }
+            m_Stream.read_view(skipped);
+            m_SkippedBytes += skipped;
+        }
+    }
+
+    size_t skipped_bytes() const { return m_SkippedBytes; }
+    size_t corruptions() const { return m_Corruptions; }
+
+private:
+    MemoryBinaryStream& m_Stream;
+    size_t m_SkippedBytes;
+    size_t m_Corruptions;
+};
+
+/// Compression of independent blocks, implementations must be usable from several threads
+class BlockCodec
+{
+public:
+    virtual ~BlockCodec() {}
+
+    /// Maximum compressed size of n bytes
+    virtual size_t compress_bound(size_t n) const = 0;
+    /// Return the compressed size, written in pDestination of compress_bound(n) bytes
+    virtual size_t compress(const uint8_t* pSource, size_t n, uint8_t* pDestination) const = 0;
+    /// Return false if the block is corrupted or does not decompress to exactly size bytes
+    virtual bool decompress(const uint8_t* pSource, size_t n, uint8_t* pDestination, size_t size) const = 0;
+    /// Maximum decompressed size of n compressed bytes, larger sizes are corruptions
+    virtual size_t decompress_bound(size_t n) const = 0;
+};
+
+/// Built-in LZ77 codec in the spirit of LZ4: sequences of a token (literal and match lengths), 
+/// the literals, a 16 bits offset and the match length extension. Fast rather than dense
+class LzCodec : public BlockCodec
+{
+public:
+    virtual size_t compress_bound(size_t n) const override { return n + n / 255 + 16; }
+
+    // Every byte of a length extension adds at most 255 bytes, the other bytes less
+    virtual size_t decompress_bound(size_t n) const override { return n > SIZE_MAX / 255 ? SIZE_MAX : n * 255; }
+
+    virtual size_t compress(const uint8_t* pSource, size_t n, uint8_t* pDestination) const override
+    {
+        uint32_t table[HASH_SIZE];
+        std::fill(table, table + HASH_SIZE, 0);// Positions + 1, 0 is empty
+
+        uint8_t* pOut = pDestination;
+        size_t anchor = 0;
+        size_t position = 0;
+        size_t misses = 0;
+        size_t limit = n > END_LITERALS + MIN_MATCH ? n - END_LITERALS : 0;
+        while (position + MIN_MATCH <= limit)
+        {
+            uint32_t sequence = read32(pSource + position);
+            uint32_t& entry = table[hash(sequence)];
+            size_t candidate = entry;
+            entry = (uint32_t)(position + 1);
+            if (candidate == 0 || position + 1 - candidate > MAX_OFFSET || read32(pSource + candidate - 1) != sequence)
+            {
+                position += 1 + (misses++ >> 6);// Skip faster through incompressible data
+                continue;
+            }
+            misses = 0;
+            size_t match = candidate - 1;
+            size_t length = MIN_MATCH;
+            while (position + length < limit && pSource[match + length] == pSource[position + length])
+            {
+                ++length;
+            }
+            pOut = write_sequence(pOut, pSource + anchor, position - anchor, position - match, length);
+            position += length;
+            anchor = position;
+        }
+        pOut = write_sequence(pOut, pSource + anchor, n - anchor, 0, 0);
+        return pOut - pDestination;
+    }
+
+    virtual bool decompress(const uint8_t* pSource, size_t n, uint8_t* pDestination, size_t size) const override
+    {
+        const uint8_t* pEnd = pSource + n;
+        uint8_t* pOut = pDestination;
+        uint8_t* pOutEnd = pDestination + size;
+        while (pSource < pEnd)
+        {
+            uint8_t token = *pSource++;
+            size_t literals = token >> 4;
+            if (!read_length(pSource, pEnd, literals) || (size_t)(pEnd - pSource) < literals || (size_t)(pOutEnd - pOut) < literals)
+            {
+                return false;
+            }
+            if (literals > 0)
+            {
+                memcpy(pOut, pSource, literals);
+            }
+            pOut += literals;
+            pSource += literals;
+            if (pSource == pEnd)
+            {
+                break;// The last sequence has no match
+            }
+
+            if (pEnd - pSource < 2)
+            {
+                return false;
+            }
+            size_t offset = pSource[0] | ((size_t)pSource[1] << 8);
+            pSource += 2;
+            size_t length = token & 15;
+            if (!read_length(pSource, pEnd, length))
+            {
+                return false;
+            }
+            length += MIN_MATCH;
+            if (offset == 0 || offset > (size_t)(pOut - pDestination) || (size_t)(pOutEnd - pOut) < length)
+            {
+                return false;
+            }
+            const uint8_t* pMatch = pOut - offset;
+            if (offset >= length)
+            {
+                memcpy(pOut, pMatch, length);
+                pOut += length;
+            }
+            else
+            {
+                for (size_t i = 0; i < length; ++i)// Overlapping copy repeats the pattern
+                {
+                    *pOut++ = *pMatch++;
+                }
+            }
+        }
+        return pOut == pOutEnd;
+    }
+
+private:
+    static const size_t HASH_BITS = 14;
+    static const size_t HASH_SIZE = 1 << HASH_BITS;
+    static const size_t MIN_MATCH = 4;
+    static const size_t END_LITERALS = 8;
+    static const size_t MAX_OFFSET = 65535;
+
+    static uint32_t read32(const uint8_t* pData)
+    {
+        uint32_t value;
+        memcpy(&value, pData, sizeof(value));
+        return value;
+    }
+
+    static uint32_t hash(uint32_t sequence) { return (sequence * 2654435761u) >> (32 - HASH_BITS); }
+
+    static uint8_t* write_length(uint8_t* pOut, size_t length)
+    {
+        for (length -= 15; length >= 255; length -= 255)
+        {
+            *pOut++ = 255;
+        }
+        *pOut++ = (uint8_t)length;
+        return pOut;
+    }
+
+    static bool read_length(const uint8_t*& pSource, const uint8_t* pEnd, size_t& length)
+    {
+        if (length != 15)
+        {
+            return true;
+        }
+        uint8_t byte = 255;
+        while (byte == 255)
+        {
+            if (pSource == pEnd)
+            {
+                return false;
+            }
+            byte = *pSource++;
+            length += byte;
+        }
+        return true;
+    }
+
+    // A match length of 0 writes the last literals only
+    static uint8_t* write_sequence(uint8_t* pOut, const uint8_t* pLiterals, size_t literals, size_t offset, size_t length)
+    {
+        size_t matchLength = length > 0 ? length - MIN_MATCH : 0;
+        uint8_t* pToken = pOut++;
+        *pToken = (uint8_t)((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(matchLength, 15));
+        if (literals >= 15)
+        {
+            pOut = write_length(pOut, literals);
+        }
+        if (literals > 0)// pLiterals can be null for an empty block
+        {
+            memcpy(pOut, pLiterals, literals);
+        }
+        pOut += literals;
+        if (length > 0)
+        {
+            *pOut++ = (uint8_t)offset;
+            *pOut++ = (uint8_t)(offset >> 8);
+            if (matchLength >= 15)
+            {
+                pOut = write_length(pOut, matchLength);
+            }
+        }
+        return pOut;
+    }
+};
+
+/// Block framing shared by CompressingBuffer and DecompressingBuffer: each block is 
+/// the little-endian raw size, the little-endian stored size, then the stored bytes.
+/// The top bit of the stored size marks a block kept uncompressed
+class CompressedBlocks
+{
+public:
+    static const size_t HEADER_SIZE = 2 * sizeof(uint32_t);
+    static const uint32_t RAW_FLAG = 0x80000000u;
+
+    struct Block
+    {
+        const uint8_t* m_pData;
+        size_t m_StoredSize;
+        size_t m_RawSize;
+        bool m_Raw;
+    };
+
+    /// Split the framed data in blocks, false if a header is truncated
+    static bool parse(MemoryView input, std::vector<Block>& blocks)
+    {
+        const uint8_t* pData = input.data();
+        const uint8_t* pEnd = pData + input.size();
+        while (pData != pEnd)
+        {
+            Block block;
+            if (!parse(pData, pEnd, block))
+            {
+                return false;
+            }
+            blocks.push_back(block);
+            pData = block.m_pData + block.m_StoredSize;
+        }
+        return true;
+    }
+
+    static bool parse(const uint8_t* pData, const uint8_t* pEnd, Block& block)
+    {
+        if ((size_t)(pEnd - pData) < HEADER_SIZE)
+        {
+            return false;
+        }
+        uint32_t rawSize = read_le32(pData);
+        uint32_t storedSize = read_le32(pData + sizeof(uint32_t));
+        block.m_pData = pData + HEADER_SIZE;
+        block.m_Raw = (storedSize & RAW_FLAG) != 0;
+        block.m_StoredSize = storedSize & ~RAW_FLAG;
+        block.m_RawSize = rawSize;
+        return (size_t)(pEnd - block.m_pData) >= block.m_StoredSize && (!block.m_Raw || block.m_StoredSize == block.m_RawSize);
+    }
+
+    static uint32_t read_le32(const uint8_t* pData)
+    {
+        return pData[0] | ((uint32_t)pData[1] << 8) | ((uint32_t)pData[2] << 16) | ((uint32_t)pData[3] << 24);
+    }
+
+    /// False if the raw size cannot be produced by the stored bytes, checked before allocating it
+    static bool bounded(const BlockCodec& codec, const Block& block)
+    {
+        return block.m_Raw || block.m_RawSize <= codec.decompress_bound(block.m_StoredSize);
+    }
+
+    static bool decode(const BlockCodec& codec, const Block& block, uint8_t* pDestination)
+    {
+        if (block.m_Raw)
+        {
+            if (block.m_RawSize > 0)
+            {
+                memcpy(pDestination, block.m_pData, block.m_RawSize);
+            }
+            return true;
+        }
+        return codec.decompress(block.m_pData, block.m_StoredSize, pDestination, block.m_RawSize);
+    }
+};
+
+/// Compress the bytes written by blocks into a MemoryBinaryStream, so the uncompressed 
+/// data never exists as a whole. A flush of the stream emits a (shorter) block
+class CompressingBuffer : public std::streambuf
+{
+public:
+    static const size_t BLOCK_SIZE = 256 * 1024;
+
+    CompressingBuffer(MemoryBinaryStream& inOutput, std::shared_ptr<const BlockCodec> inCodec = std::make_shared<LzCodec>(), size_t inBlockSize = BLOCK_SIZE)
+        : m_Output(inOutput), m_xCodec(inCodec), m_Block(std::max<size_t>(std::min<size_t>(inBlockSize, CompressedBlocks::RAW_FLAG - 1), 1))
+    {
+        setp((char*)m_Block.data(), (char*)m_Block.data() + m_Block.size());
+    }
+
+    /// Best effort flush of the last block, call finish() to get the errors
+    ~CompressingBuffer()
+    {
+        try
+        {
+            emit_block();
+        }
+        catch (...)
+        {
+            // The last block is lost, a destructor cannot report it
+        }
+    }
+
+    /// Emit the pending bytes as the last block, throws if the output cannot be written
+    void finish() { emit_block(); }
+
+protected:
+    virtual int_type overflow(int_type ch) override
+    {
+        emit_block();
+        if (ch != traits_type::eof())
+        {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    virtual std::streamsize xsputn(const char* s, std::streamsize n) override
+    {
+        std::streamsize written = 0;
+        while (written < n)
+        {
+            if (pptr() == epptr())
+            {
+                emit_block();
+            }
+            std::streamsize count = std::min<std::streamsize>(epptr() - pptr(), n - written);
+            memcpy(pptr(), s + written, count);
+            pbump(count);
+            written += count;
+        }
+        return n;
+    }
+
+    virtual int sync() override
+    {
+        emit_block();
+        return 0;
+    }
+
+private:
+    MemoryBinaryStream& m_Output;
+    std::shared_ptr<const BlockCodec> m_xCodec;
+    std::vector<uint8_t> m_Block;
+    std::vector<uint8_t> m_Compressed;
+
+    void emit_block()
+    {
+        size_t size = pptr() - pbase();
+        if (size == 0)
+        {
+            return;
+        }
+        m_Compressed.resize(m_xCodec->compress_bound(size));
+        size_t compressedSize = m_xCodec->compress(m_Block.data(), size, m_Compressed.data());
+        bool raw = compressedSize >= size;
+
+        BinaryEncoding::write_fixed<Endian::Little>(m_Output, (uint32_t)size);
+        BinaryEncoding::write_fixed<Endian::Little>(m_Output, (uint32_t)(raw ? (size | CompressedBlocks::RAW_FLAG) : compressedSize));
+        m_Output.put_bytes(raw ? m_Block.data() : m_Compressed.data(), raw ? size : compressedSize);
+        setp((char*)m_Block.data(), (char*)m_Block.data() + m_Block.size());
+    }
+};
+
+class CompressingBinaryStream : private StreamBufferMember<CompressingBuffer>, public std::ostream
+{
+public:
+    CompressingBinaryStream(MemoryBinaryStream& inOutput) : StreamBufferMember<CompressingBuffer>(inOutput), std::ostream(&m_Buffer) {}
+    CompressingBinaryStream(MemoryBinaryStream& inOutput, std::shared_ptr<const BlockCodec> inCodec, size_t inBlockSize = CompressingBuffer::BLOCK_SIZE) 
+        : StreamBufferMember<CompressingBuffer>(inOutput, inCodec, inBlockSize), std::ostream(&m_Buffer) {}
+
+    template <typename T>
+    CompressingBinaryStream& operator<<(T value)
+    {
+        write((char*)&value, sizeof(T));
+        return *this;
+    }
+
+    CompressingBinaryStream& operator<<(const char* pValue)
+    {
+        write((char*)pValue, strlen(pValue));
+        return *this;
+    }
+
+    /// Emit the last block, the destructor does it ignoring the errors
+    void finish() { m_Buffer.finish(); }
+};
+
+/// Read side of CompressingBuffer, decompressing one block at a time from the framed data.
+/// A corrupted block throws std::runtime_error, reported as badbit by the stream
+class DecompressingBuffer : public std::streambuf
+{
+public:
+    DecompressingBuffer(MemoryView inInput, std::shared_ptr<const BlockCodec> inCodec = std::make_shared<LzCodec>())
+        : m_Input(inInput), m_Position(0), m_xCodec(inCodec)
+    {
+        setg(nullptr, nullptr, nullptr);
+    }
+
+    /// Decompress all the blocks of input into output, sized once, with up to threads threads
+    static bool decompress_parallel(MemoryView input, std::vector<uint8_t>& output, const BlockCodec& codec, 
+        unsigned threads = std::thread::hardware_concurrency(), size_t maxSize = SIZE_MAX)
+    {
+        std::vector<CompressedBlocks::Block> blocks;
+        if (!CompressedBlocks::parse(input, blocks))
+        {
+            return false;
+        }
+        // The sizes come from the headers, they are validated before allocating the output
+        std::vector<size_t> offsets(blocks.size() + 1, 0);
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            if (!CompressedBlocks::bounded(codec, blocks[i]) || blocks[i].m_RawSize > maxSize - offsets[i])
+            {
+                return false;
+            }
+            offsets[i + 1] = offsets[i] + blocks[i].m_RawSize;
+        }
+        output.resize(offsets.back());
+
+        std::atomic<size_t> next(0);
+        std::atomic<bool> valid(true);
+        auto worker = [&]()
+        {
+            for (size_t i = next++; i < blocks.size(); i = next++)
+            {
+                if (!CompressedBlocks::decode(codec, blocks[i], output.data() + offsets[i]))
+                {
+                    valid = false;
+                }
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < std::min<size_t>(std::max(threads, 1u), blocks.size()); ++i)
+        {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : workers)
+        {
+            thread.join();
+        }
+        return valid;
+    }
+
+protected:
+    virtual int_type underflow() override
+    {
+        // Empty blocks are skipped in a loop, the input can contain any number of them
+        while (m_Position != m_Input.size())
+        {
+            CompressedBlocks::Block block;
+            const uint8_t* pData = m_Input.data() + m_Position;
+            if (!CompressedBlocks::parse(pData, m_Input.data() + m_Input.size(), block))
+            {
+                throw std::runtime_error("DecompressingBuffer: truncated block");
+            }
+            if (!CompressedBlocks::bounded(*m_xCodec, block))
+            {
+                throw std::runtime_error("DecompressingBuffer: corrupted block");
+            }
+            m_Block.resize(block.m_RawSize);
+            if (!CompressedBlocks::decode(*m_xCodec, block, m_Block.data()))
+            {
+                throw std::runtime_error("DecompressingBuffer: corrupted block");
+            }
+            m_Position = block.m_pData + block.m_StoredSize - m_Input.data();
+            setg((char*)m_Block.data(), (char*)m_Block.data(), (char*)m_Block.data() + m_Block.size());
+            if (!m_Block.empty())
+            {
+                return traits_type::to_int_type(*gptr());
+            }
+        }
+        return traits_type::eof();
+    }
+
+private:
+    MemoryView m_Input;
+    size_t m_Position;
+    std::shared_ptr<const BlockCodec> m_xCodec;
+    std::vector<uint8_t> m_Block;
+};
+
+class DecompressingBinaryStream : private StreamBufferMember<DecompressingBuffer>, public std::istream
+{
+public:
+    DecompressingBinaryStream(MemoryView inInput) : StreamBufferMember<DecompressingBuffer>(inInput), std::istream(&m_Buffer) {}
+    DecompressingBinaryStream(MemoryView inInput, std::shared_ptr<const BlockCodec> inCodec) 
+        : StreamBufferMember<DecompressingBuffer>(inInput, inCodec), std::istream(&m_Buffer) {}
+
+    template <typename T, typename = typename std::enable_if<std::is_trivially_copyable<T>::value>::type>
+    DecompressingBinaryStream& operator>>(T& value)
+    {
+        read((char*)&value, sizeof(T));
+        return *this;
+    }
+};
+/// End
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+
+struct CountWriter
+{
+    size_t count;
+
+    template <typename Stream>
+    void operator()(Stream& stream) const
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            stream << (uint32_t)i;
+        }
+    }
+};
+
+void directWriteBenchmark()
+{
+    const uint32_t count = 16 * 1024 * 1024;
+
+    auto start = std::chrono::steady_clock::now();
+    MemoryBinaryStream streamed;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        streamed << i;
+    }
+    auto streamedTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    MemoryBinaryStream direct;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        direct.put(i);
+    }
+    auto directTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    MemoryBinaryStream batched;
+    const uint32_t batch = 1024;
+    for (uint32_t i = 0; i < count; i += batch)
+    {
+        uint8_t* pData = batched.reserve_and_get(batch * sizeof(uint32_t));
+        for (uint32_t j = 0; j < batch; ++j)
+        {
+            uint32_t value = i + j;
+            memcpy(pData + j * sizeof(uint32_t), &value, sizeof(uint32_t));
+        }
+    }
+    auto batchedTime = std::chrono::steady_clock::now() - start;
+
+    std::cout << count << " writes of uint32_t" << std::endl;
+    std::cout << "operator<< " << std::chrono::duration_cast<std::chrono::milliseconds>(streamedTime).count() << " ms" << std::endl;
+    std::cout << "put " << std::chrono::duration_cast<std::chrono::milliseconds>(directTime).count() << " ms, same content: " 
+        << (direct.data() == streamed.data()) << std::endl;
+    std::cout << "reserve_and_get " << std::chrono::duration_cast<std::chrono::milliseconds>(batchedTime).count() << " ms, same content: " 
+        << (batched.data() == streamed.data()) << std::endl;
+}
+
+void encodingTest()
+{
+    MemoryBinaryStream stream;
+    BinaryEncoding::write_varint(stream, 300);
+    BinaryEncoding::write_signed_varint(stream, -2);
+    BinaryEncoding::write_fixed<Endian::Big>(stream, (uint32_t)0x01020304);
+    BinaryEncoding::write_fixed<Endian::Little>(stream, 1.5);
+    BinaryEncoding::write_string(stream, "Hello");
+    BinaryEncoding::write_string(stream, "World");
+    std::cout << "Encoded " << stream.data().size() << " bytes:";
+    for (const auto& d : stream.data())
+    {
+        std::cout << " " << (unsigned int)d;
+    }
+    std::cout << std::endl;
+
+    uint64_t varint = 0;
+    int64_t signedVarint = 0;
+    uint32_t big = 0;
+    double little = 0;
+    std::string hello, world;
+    BinaryEncoding::read_varint(stream, varint);
+    BinaryEncoding::read_signed_varint(stream, signedVarint);
+    BinaryEncoding::read_fixed<Endian::Big>(stream, big);
+    BinaryEncoding::read_fixed<Endian::Little>(stream, little);
+    BinaryEncoding::read_string(stream, hello);
+    BinaryEncoding::read_string(stream, world);
+    std::cout << "Decoded " << varint << " " << signedVarint << " " << std::hex << big << std::dec << " " << little 
+        << " " << hello << " " << world << ", truncated read fails: " << !BinaryEncoding::read_varint(stream, varint) << std::endl;
+
+    // Overlong and out of range varints
+    const uint8_t overlong[] = { 0x80, 0x00 };
+    const uint8_t tooLarge[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x02 };
+    const uint8_t largest[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01 };
+    MemoryBinaryStream invalid;
+    invalid.put_bytes(overlong, sizeof(overlong));
+    bool overlongFails = !BinaryEncoding::read_varint(invalid, varint);
+    invalid.reset();
+    invalid.put_bytes(tooLarge, sizeof(tooLarge));
+    bool tooLargeFails = !BinaryEncoding::read_varint(invalid, varint);
+    invalid.reset();
+    invalid.put_bytes(largest, sizeof(largest));
+    bool largestReads = BinaryEncoding::read_varint(invalid, varint) && varint == UINT64_MAX;
+    std::cout << "Overlong varint fails: " << overlongFails << ", 10th byte above 1 fails: " << tooLargeFails 
+        << ", UINT64_MAX reads: " << largestReads << std::endl;
+
+    // Bulk encodings of small values
+    const size_t count = 4 * 1024 * 1024;
+    std::vector<uint32_t> values(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        values[i] = (uint32_t)(i * 2654435761u) >> (8 * (i % 4));
+    }
+
+    MemoryBinaryStream bigEndian;
+    auto start = std::chrono::steady_clock::now();
+    BinaryEncoding::write_fixed_array<Endian::Big>(bigEndian, values.data(), count);
+    std::vector<uint32_t> decoded(count);
+    BinaryEncoding::read_fixed_array<Endian::Big>(bigEndian, decoded.data(), count);
+    auto bigEndianTime = std::chrono::steady_clock::now() - start;
+    std::cout << "Big endian array " << bigEndian.data().size() << " bytes, round trip in " 
+        << std::chrono::duration_cast<std::chrono::milliseconds>(bigEndianTime).count() << " ms, same content: " << (decoded == values) << std::endl;
+
+    MemoryBinaryStream group;
+    start = std::chrono::steady_clock::now();
+    BinaryEncoding::write_group_varint(group, values.data(), count);
+    auto encodeTime = std::chrono::steady_clock::now() - start;
+    std::fill(decoded.begin(), decoded.end(), 0);
+    start = std::chrono::steady_clock::now();
+    BinaryEncoding::read_group_varint(group, decoded.data(), count);
+    auto decodeTime = std::chrono::steady_clock::now() - start;
+    std::cout << "Group varint " << group.data().size() << " bytes, encoded in " 
+        << std::chrono::duration_cast<std::chrono::milliseconds>(encodeTime).count() << " ms, decoded in "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(decodeTime).count() << " ms, same content: " << (decoded == values) << std::endl;
+
+    // Varints one at a time against the bulk functions, a quarter of the values are below 128
+    std::vector<uint64_t> wide(values.begin(), values.end());
+    std::vector<uint64_t> wideDecoded(count);
+    MemoryBinaryStream single;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        BinaryEncoding::write_varint(single, wide[i]);
+    }
+    encodeTime = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        BinaryEncoding::read_varint(single, wideDecoded[i]);
+    }
+    decodeTime = std::chrono::steady_clock::now() - start;
+    std::cout << "Varint one at a time " << single.data().size() << " bytes, encoded in "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(encodeTime).count() << " ms, decoded in "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(decodeTime).count() << " ms, same content: " << (wideDecoded == wide) << std::endl;
+
+    MemoryBinaryStream bulk;
+    std::fill(wideDecoded.begin(), wideDecoded.end(), 0);
+    start = std::chrono::steady_clock::now();
+    BinaryEncoding::write_varint_array(bulk, wide.data(), count);
+    encodeTime = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    BinaryEncoding::read_varint_array(bulk, wideDecoded.data(), count);
+    decodeTime = std::chrono::steady_clock::now() - start;
+    std::cout << "Varint array " << bulk.data().size() << " bytes, encoded in "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(encodeTime).count() << " ms, decoded in "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(decodeTime).count() << " ms, same content: " << (wideDecoded == wide) 
+        << ", same bytes: " << (bulk.data() == single.data()) << std::endl;
+
+    // Small values take the 8 bytes path
+    std::vector<uint64_t> small(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        small[i] = wide[i] & 0x7f;
+    }
+    MemoryBinaryStream smallBulk;
+    BinaryEncoding::write_varint_array(smallBulk, small.data(), count);
+    start = std::chrono::steady_clock::now();
+    BinaryEncoding::read_varint_array(smallBulk, wideDecoded.data(), count);
+    decodeTime = std::chrono::steady_clock::now() - start;
+    std::cout << "Varint array of values below 128 decoded in " 
+        << std::chrono::duration_cast<std::chrono::milliseconds>(decodeTime).count() << " ms, same content: " << (wideDecoded == small) << std::endl;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+void mappedFileTest()
+{
+    const char* pPath = "/tmp/MemoryBinaryStream.bin";
+    const uint32_t count = 4 * 1024 * 1024;
+    {
+        MappedFileBinaryStream output(pPath, MappedFileBuffer::Write);
+        output << "Mapped\n";
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            output << i;
+        }
+    }
+
+    MappedFileBinaryStream input(pPath, MappedFileBuffer::Read);
+    MemoryView header = input.read_view(7);
+    bool same = true;
+    for (uint32_t i = 0; i < count && same; ++i)
+    {
+        uint32_t value = 0;
+        input >> value;
+        same = (value == i);
+    }
+    std::cout << std::string(header.begin(), header.end()) << input.size() << " bytes mapped, same content: " << same << std::endl;
+    input.close();
+    std::remove(pPath);
+}
+#endif
+
+void poolTest()
+{
+    const size_t requests = 1000000;
+    size_t total = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < requests; ++i)
+    {
+        MemoryBinaryStream stream;
+        for (uint32_t j = 0; j < 16 + i % 64; ++j)
+        {
+            stream.put(j);
+        }
+        total += stream.data().size();
+    }
+    auto freshTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < requests; ++i)
+    {
+        MemoryStreamPool::Lease stream = MemoryStreamPool::local().lease(512);
+        for (uint32_t j = 0; j < 16 + i % 64; ++j)
+        {
+            stream->put(j);
+        }
+        total -= stream->data().size();
+    }
+    auto pooledTime = std::chrono::steady_clock::now() - start;
+
+    size_t retained = MemoryStreamPool::local().retained();
+    std::vector<uint8_t> released;
+    {
+        MemoryStreamPool::Lease stream = MemoryStreamPool::local().lease();
+        *stream << "Released";
+        released = stream->release();
+    }
+
+    std::cout << requests << " requests, new streams " << std::chrono::duration_cast<std::chrono::milliseconds>(freshTime).count() 
+        << " ms, pooled streams " << std::chrono::duration_cast<std::chrono::milliseconds>(pooledTime).count() << " ms, same sizes: " << (total == 0)
+        << ", retained " << retained << " bytes, released " << std::string(released.begin(), released.end()) << std::endl;
+
+    // A lease destroyed on another thread is freed, the pool of the main thread is unchanged
+    MemoryStreamPool::Lease moved = MemoryStreamPool::local().lease(4096);
+    retained = MemoryStreamPool::local().retained();
+    std::thread([&moved]() { MemoryStreamPool::Lease local(std::move(moved)); }).join();
+    bool unchanged = MemoryStreamPool::local().retained() == retained;
+
+    // The thread_local lease is constructed first so it is destroyed after the pool of its thread
+    bool leased = false;
+    std::thread([&leased]()
+    {
+        static thread_local MemoryStreamPool::Lease held;
+        held = MemoryStreamPool::local().lease(4096);
+        leased = held->capacity() >= 4096;
+    }).join();
+    std::cout << "Lease destroyed on another thread leaves the pool unchanged: " << unchanged
+        << ", lease outliving its pool freed at thread exit: " << leased << std::endl;
+}
+
+void concurrentTest()
+{
+    const size_t records = 1024 * 1024;
+    struct Record
+    {
+        uint32_t m_Writer;
+        uint32_t m_Index;
+        uint64_t m_Value;
+    };
+
+    for (uint32_t writers = 1; writers <= 4; writers *= 2)
+    {
+        // Shared stream guarded by a mutex
+        MemoryBinaryStream shared;
+        std::mutex sharedMutex;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (uint32_t w = 0; w < writers; ++w)
+        {
+            threads.emplace_back([&, w]()
+            {
+                for (uint32_t i = 0; i < records / writers; ++i)
+                {
+                    Record record = { w, i, (uint64_t)i * i };
+                    std::lock_guard<std::mutex> lock(sharedMutex);
+                    shared.put(record);
+                }
+            });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        auto sharedTime = std::chrono::steady_clock::now() - start;
+        threads.clear();
+
+        // Concurrent append with a reader consuming in parallel
+        ConcurrentMemoryBuffer buffer(64 * 1024);
+        std::atomic<bool> done(false);
+        size_t read = 0;
+        bool valid = true;
+        start = std::chrono::steady_clock::now();
+        std::thread reader([&]()
+        {
+            std::vector<uint32_t> next(writers, 0);
+            MemoryView view;
+            while (read < records)
+            {
+                if (!buffer.try_read(view))
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                Record record;
+                memcpy(&record, view.data(), sizeof(record));
+                valid = valid && view.size() == sizeof(record) && record.m_Index == next[record.m_Writer]++ && record.m_Value == (uint64_t)record.m_Index * record.m_Index;
+                ++read;
+            }
+        });
+        for (uint32_t w = 0; w < writers; ++w)
+        {
+            threads.emplace_back([&, w]()
+            {
+                for (uint32_t i = 0; i < records / writers; ++i)
+                {
+                    Record record = { w, i, (uint64_t)i * i };
+                    buffer.append(&record, sizeof(record));
+                }
+            });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        reader.join();
+        auto concurrentTime = std::chrono::steady_clock::now() - start;
+
+        std::cout << writers << " writers, mutex " << std::chrono::duration_cast<std::chrono::milliseconds>(sharedTime).count() 
+            << " ms, concurrent with reader " << std::chrono::duration_cast<std::chrono::milliseconds>(concurrentTime).count() 
+            << " ms, " << read << " records read in order: " << valid << std::endl;
+    }
+
+    // The slots of the segments freed by the reader are reused, the capacity limits
+    // only the unread data: 3M one-record segments go through a 1M slots directory
+    ConcurrentMemoryBuffer small(16);
+    uint64_t consumed = 0;
+    MemoryView view;
+    for (uint64_t i = 0; i < 3 * 1024 * 1024; ++i)
+    {
+        small.append(&i, sizeof(i));
+        if (small.try_read(view) && view.size() == sizeof(i) && memcmp(view.data(), &i, sizeof(i)) == 0)
+        {
+            ++consumed;
+        }
+    }
+    std::cout << consumed << " records read through " << small.segment_size() << " bytes segments" << std::endl;
+
+    // A reservation dropped without commit and the records reserved when the capacity is
+    // exceeded are skipped, the reader does not stall on them
+    ConcurrentMemoryBuffer full(16);
+    {
+        ConcurrentMemoryBuffer::Reservation dropped = full.reserve(sizeof(uint64_t));
+    }
+    uint64_t appended = 0;
+    uint64_t lost = 0;
+    for (uint64_t i = 0; i < 1024 * 1024 + 2; ++i)
+    {
+        try
+        {
+            full.append(&i, sizeof(i));
+            ++appended;
+        }
+        catch (std::length_error&)
+        {
+            ++lost;
+        }
+    }
+    consumed = 0;
+    while (full.try_read(view))
+    {
+        ++consumed;
+    }
+    full.append(&appended, sizeof(appended));
+    consumed += full.try_read(view) ? 1 : 0;
+    std::cout << appended << " records appended, " << lost << " lost when full, " << consumed << " read" << std::endl;
+}
+
+void compressionTest()
+{
+    const uint32_t count = 8 * 1024 * 1024;
+    MemoryBinaryStream compressed;
+    auto start = std::chrono::steady_clock::now();
+    {
+        CompressingBinaryStream stream(compressed);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            stream << (uint32_t)(i / 16) << (uint16_t)(i % 7);
+        }
+        stream.finish();
+    }
+    auto compressTime = std::chrono::steady_clock::now() - start;
+    MemoryView frames(compressed.data().data(), compressed.data().size());
+
+    start = std::chrono::steady_clock::now();
+    DecompressingBinaryStream input(frames);
+    bool same = true;
+    for (uint32_t i = 0; i < count && same; ++i)
+    {
+        uint32_t value = 0;
+        uint16_t modulo = 0;
+        input >> value >> modulo;
+        same = input && value == i / 16 && modulo == i % 7;
+    }
+    auto streamTime = std::chrono::steady_clock::now() - start;
+
+    std::vector<uint8_t> output;
+    start = std::chrono::steady_clock::now();
+    bool valid = DecompressingBuffer::decompress_parallel(frames, output, LzCodec());
+    auto parallelTime = std::chrono::steady_clock::now() - start;
+    valid = valid && output.size() == (size_t)count * 6;
+    for (uint32_t i = 0; i < count && valid; ++i)
+    {
+        uint32_t value = 0;
+        uint16_t modulo = 0;
+        memcpy(&value, output.data() + 6 * (size_t)i, sizeof(value));
+        memcpy(&modulo, output.data() + 6 * (size_t)i + sizeof(value), sizeof(modulo));
+        valid = value == i / 16 && modulo == i % 7;
+    }
+
+    // A corrupted raw size or an output above the caller limit is rejected before allocating
+    std::vector<uint8_t> corrupted(compressed.data().begin(), compressed.data().end());
+    corrupted[0] = corrupted[1] = corrupted[2] = corrupted[3] = 0xFF;
+    std::vector<uint8_t> rejected;
+    bool corruptionRejected = !DecompressingBuffer::decompress_parallel(MemoryView(corrupted.data(), corrupted.size()), rejected, LzCodec())
+        && rejected.empty();
+    bool limitRejected = !DecompressingBuffer::decompress_parallel(frames, rejected, LzCodec(), 1, 1024) && rejected.empty();
+
+    // Empty blocks are skipped without recursion
+    MemoryBinaryStream padded;
+    for (uint32_t i = 0; i < 1024 * 1024; ++i)
+    {
+        BinaryEncoding::write_fixed<Endian::Little>(padded, (uint32_t)0);
+        BinaryEncoding::write_fixed<Endian::Little>(padded, CompressedBlocks::RAW_FLAG);
+    }
+    padded.put_bytes(frames.data(), frames.size());
+    DecompressingBinaryStream paddedInput(MemoryView(padded.data().data(), padded.data().size()));
+    uint32_t first = 1;
+    paddedInput >> first;
+    bool emptySkipped = paddedInput && first == 0;
+
+    std::cout << "Compressed " << (size_t)count * 6 << " bytes to " << compressed.data().size() << " in " 
+        << std::chrono::duration_cast<std::chrono::milliseconds>(compressTime).count() << " ms, stream read "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(streamTime).count() << " ms, same content: " << same << ", parallel decompression "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(parallelTime).count() << " ms of " << output.size() << " bytes, same content: " << valid 
+        << ", corrupted size rejected: " << corruptionRejected << ", limit rejected: " << limitRejected 
+        << ", empty blocks skipped: " << emptySkipped << std::endl;
+}
+
+void recordTest()
+{
+    std::cout << "CRC32C check value " << std::hex << Crc32c::compute("123456789", 9) << " " << Crc32c::compute_software("123456789", 9) 
+        << std::dec << ", hardware " << Crc32c::hardware_supported() << std::endl;
+
+    std::vector<uint8_t> block(64 * 1024 * 1024);
+    for (size_t i = 0; i < block.size(); ++i)
+    {
+        block[i] = (uint8_t)(i * 31 + (i >> 8));
+    }
+    auto start = std::chrono::steady_clock::now();
+    uint32_t hardware = Crc32c::compute(block.data(), block.size());
+    auto hardwareTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    uint32_t software = Crc32c::compute_software(block.data(), block.size());
+    auto softwareTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "CRC32C of " << block.size() << " bytes, dispatched " << block.size() / hardwareTime / 1e9 << " GB/s, slicing-by-8 " 
+        << block.size() / softwareTime / 1e9 << " GB/s, same value: " << (hardware == software) << std::endl;
+
+    MemoryBinaryStream stream;
+    RecordWriter writer(stream);
+    const uint32_t count = 1000;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        std::string payload = "Record " + std::to_string(i);
+        writer.write(i % 3, payload.data(), payload.size());
+    }
+
+    // Corrupt two records in the middle of the stream, and the length of the first one
+    std::vector<uint8_t> bytes(stream.data());
+    bytes[bytes.size() / 3] ^= 0x10;
+    bytes[bytes.size() / 2] ^= 0x01;
+    bytes[4 + 2] ^= 0x01;
+    MemoryBinaryStream corrupted(bytes);
+    RecordReader reader(corrupted);
+    RecordReader::Record record;
+    size_t read = 0;
+    while (reader.next(record))
+    {
+        ++read;
+    }
+    std::cout << read << " records read out of " << count << ", " << reader.corruptions() << " corruptions, " << reader.skipped_bytes() << " bytes skipped" << std::endl;
+}
+
+void segmentedTest()
+{
+    const size_t count = 4 * 1024 * 1024;
+
+    auto start = std::chrono::steady_clock::now();
+    MemoryBinaryStream contiguous(64 * 1024);
+    CountWriter{ count }(contiguous);
+    auto contiguousTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    MemoryBinaryStream geometric;
+    CountWriter{ count }(geometric);
+    auto geometricTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> exact = write_exact(CountWriter{ count });
+    auto exactTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    SegmentedMemoryBinaryStream segmented;
+    CountWriter{ count }(segmented);
+    auto segmentedTime = std::chrono::steady_clock::now() - start;
+
+    std::cout << "Contiguous linear " << contiguous.data().size() << " bytes in " 
+        << std::chrono::duration_cast<std::chrono::milliseconds>(contiguousTime).count() << " ms" << std::endl;
+    std::cout << "Contiguous geometric " << geometric.data().size() << " bytes in " 
+        << std::chrono::duration_cast<std::chrono::milliseconds>(geometricTime).count() << " ms" << std::endl;
+    std::cout << "Exact size " << exact.size() << " bytes, capacity " << exact.capacity() << " in " 
+        << std::chrono::duration_cast<std::chrono::milliseconds>(exactTime).count() << " ms, same content: " 
+        << (exact == contiguous.data()) << std::endl;
+    std::cout << "Segmented " << segmented.size() << " bytes in " << segmented.segments().size() << " segments in "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(segmentedTime).count() << " ms, same content: " 
+        << (segmented.flatten() == contiguous.data()) << std::endl;
+}
+
+int main()
+{
+   MemoryBinaryStream memoryStream;
+   memoryStream << "Hello World\n"; 
+   memoryStream << 123u << 125u << (char)123 << (char)125<<"\n"; 
+   auto data = memoryStream.data();
+   for(const auto& d: data)
+   {
+       std::cout << d << " -> "<< (unsigned int)d <<std::endl ;
+   }
+
+   // Read back what was written
+   MemoryView hello = memoryStream.read_view(12);
+   unsigned int first = 0, second = 0;
+   char third = 0, fourth = 0;
+   memoryStream >> first >> second >> third >> fourth;
+   std::cout << std::string(hello.begin(), hello.end()) << first << " " << second << " " << third << " " << fourth << std::endl;
+
+   segmentedTest();
+   directWriteBenchmark();
+   encodingTest();
+   poolTest();
+   concurrentTest();
+   compressionTest();
+   recordTest();
+#if defined(__unix__) || defined(__APPLE__)
+   mappedFileTest();
+#endif
+
+   // A fixed capacity stream throws instead of growing
+   try
+   {
+       MemoryBinaryStream fixedStream(GrowthPolicy::fixed(6));
+       fixedStream << 1u << 2u;
+   }
+   catch (const std::length_error& e)
+   {
+       std::cout << "Fixed capacity: " << e.what() << std::endl;
    }
 
    return 0;